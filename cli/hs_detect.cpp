@@ -0,0 +1,503 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Detection.h"
+#include "TraceReader/BinaryReader.h"
+#include "TraceReader/MdaReader.h"
+
+using namespace std;
+using namespace std::filesystem;
+using namespace HSDetection;
+
+// same as in the Python interface
+static constexpr float radiusEps = 1e-3; // 1nm
+static constexpr int calibChunks = 20;
+static constexpr IntFrame calibChunkLen = 10000;
+static constexpr FloatRaw badSpreadLow = 0.1; // dead if spread below this ratio to the median
+static constexpr FloatRaw badSpreadHigh = 10; // saturated or noisy if above
+// npy descr of IntVolt, by the precision mode of the build
+static const string voltDescr = is_floating_point_v<IntVolt> ? "<f4" : sizeof(IntVolt) == 4 ? "<i4" : "<i2";
+
+static const map<string, string> defaultParams = {
+    {"sampling_frequency", ""}, // required, Hz
+    {"dtype", "int16"},         // sample type of flat binary, MDA has its own
+    {"offset", "0"},            // bytes before data in flat binary
+    {"chunk_size", "100000"},
+    {"numa_aware", "false"},
+    {"rescale", "true"},
+    {"rescale_value", "-1280.0"},
+    {"common_reference", "average"},
+    {"fast_init", "false"}, // seed running estimation on the first second
+    {"bad_channels", ""},    // indices left out, separated by commas
+    {"detect_bad_channels", "false"},
+    {"spike_duration", "1.0"},
+    {"amp_avg_duration", "0.4"},
+    {"threshold", "10.0"},
+    {"min_avg_amp", "5.0"},
+    {"AHP_thr", "0.0"},
+    {"neighbor_radius", "90.0"},
+    {"inner_radius", "70.0"},
+    {"peak_jitter", "0.2"},
+    {"rise_duration", "0.26"},
+    {"decay_filtering", "false"},
+    {"decay_ratio", "1.0"},
+    {"localize", "true"},
+    {"save_shape", "true"},
+    {"compress_shape", "false"},
+    {"neighbor_shape", "false"},
+    {"left_cutout_time", "0.3"},
+    {"right_cutout_time", "1.8"},
+    {"spike_table", "false"}, // spikes.hst written as detected instead of .npy columns at the end
+    {"artifact_fraction", "0.0"}, // frames crossing on this fraction of channels blanked, none if 0
+    {"sweep", ""}, // more configs in the same pass, "threshold=8, min_avg_amp=4; threshold=12" (ms for peak_jitter)
+    {"checkpoint_file", ""}, // resumed from if existing, none if empty
+    {"checkpoint_interval", "600.0"},
+    {"verbose", "true"}};
+
+static string trim(const string &s)
+{
+    size_t start = s.find_first_not_of(" \t\r\n");
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return start == string::npos ? "" : s.substr(start, end - start + 1);
+}
+
+// lines of "key = value" or "key: value", with # for comments
+static map<string, string> readConfig(const string &filename)
+{
+    ifstream file(filename);
+    if (!file)
+    {
+        throw runtime_error("cannot open config " + filename);
+    }
+
+    map<string, string> params = defaultParams;
+    string line;
+    while (getline(file, line))
+    {
+        line = trim(line.substr(0, line.find('#')));
+        size_t sep = line.find_first_of("=:");
+        if (line.empty() || sep == string::npos)
+        {
+            continue;
+        }
+        string key = trim(line.substr(0, sep));
+        if (params.count(key) == 0)
+        {
+            fprintf(stderr, "hs-detect: ignored unknown key %s\n", key.c_str());
+            continue;
+        }
+        params[key] = trim(line.substr(sep + 1));
+    }
+
+    if (params["sampling_frequency"].empty())
+    {
+        throw runtime_error("sampling_frequency is required in config");
+    }
+    return params;
+}
+
+static bool toBool(const string &value)
+{
+    string lower = value;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return lower == "true" || lower == "1" || lower == "yes";
+}
+
+// one line of "x y" (or "x,y") for each channel, with # for comments
+static vector<FloatGeom> readProbe(const string &filename)
+{
+    ifstream file(filename);
+    if (!file)
+    {
+        throw runtime_error("cannot open probe " + filename);
+    }
+
+    vector<FloatGeom> positions;
+    string line;
+    while (getline(file, line))
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+        {
+            continue;
+        }
+        replace(line.begin(), line.end(), ',', ' ');
+        istringstream fields(line);
+        FloatGeom x, y;
+        if (!(fields >> x >> y))
+        {
+            throw runtime_error("invalid probe line: " + line);
+        }
+        positions.push_back(x);
+        positions.push_back(y);
+    }
+    return positions;
+}
+
+// 5%, 50% and 95% quantiles of each channel on random chunks as in the Python interface,
+// nearest rank instead of interpolation
+static vector<array<FloatRaw, 3>> calibrate(TraceReader &reader)
+{
+    IntChannel numChannels = reader.getNumChannels();
+    IntFrame chunkLen = min(calibChunkLen, reader.getNumFrames());
+    mt19937 rng(0);
+    uniform_int_distribution<IntFrame> chunkStart(0, reader.getNumFrames() - chunkLen);
+
+    vector<FloatRaw> data((size_t)calibChunks * chunkLen * numChannels);
+    for (int i = 0; i < calibChunks; i++)
+    {
+        reader.read(data.data() + (size_t)i * chunkLen * numChannels, chunkStart(rng), chunkLen);
+    }
+
+    size_t numSamples = (size_t)calibChunks * chunkLen;
+    vector<FloatRaw> channel(numSamples);
+    vector<array<FloatRaw, 3>> quantiles(numChannels);
+    for (IntChannel c = 0; c < numChannels; c++)
+    {
+        for (size_t t = 0; t < numSamples; t++)
+        {
+            channel[t] = data[t * numChannels + c];
+        }
+        auto quantile = [&](double q)
+        {
+            auto nth = channel.begin() + (size_t)(q * (numSamples - 1));
+            nth_element(channel.begin(), nth, channel.end());
+            return *nth;
+        };
+        quantiles[c] = {quantile(0.05), quantile(0.5), quantile(0.95)};
+    }
+    return quantiles;
+}
+
+// channels of which the spread (5% to 95%) is far from the median of all, as in the Python interface
+static void findBadChannels(const vector<array<FloatRaw, 3>> &quantiles, bool *channelMask)
+{
+    vector<FloatRaw> spreads;
+    for (const array<FloatRaw, 3> &q : quantiles)
+    {
+        spreads.push_back(q[2] - q[0]);
+    }
+    vector<FloatRaw> sorted = spreads;
+    nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    FloatRaw median = sorted[sorted.size() / 2];
+
+    for (size_t c = 0; c < spreads.size(); c++)
+    {
+        channelMask[c] |= spreads[c] <= median * badSpreadLow || spreads[c] >= median * badSpreadHigh;
+    }
+}
+
+// configs separated by semicolons, each of key=value overriding the main one
+static vector<DetectionConfig> parseSweep(const string &value, const DetectionConfig &mainConfig,
+                                          const function<IntFrame(const string &)> &toFrames)
+{
+    vector<DetectionConfig> configs;
+    istringstream sweep(value);
+    for (string entry; getline(sweep, entry, ';');)
+    {
+        if (trim(entry).empty())
+        {
+            continue;
+        }
+        DetectionConfig config = mainConfig;
+        istringstream fields(entry);
+        for (string field; getline(fields, field, ',');)
+        {
+            size_t sep = field.find('=');
+            string key = trim(field.substr(0, sep));
+            string setting = sep == string::npos ? "" : trim(field.substr(sep + 1));
+            if (key == "threshold")
+            {
+                config.threshold = stof(setting);
+            }
+            else if (key == "min_avg_amp")
+            {
+                config.minAvgAmp = stof(setting);
+            }
+            else if (key == "AHP_thr")
+            {
+                config.maxAHPAmp = stof(setting);
+            }
+            else if (key == "peak_jitter")
+            {
+                config.temporalJitter = toFrames(setting);
+            }
+            else
+            {
+                throw runtime_error("invalid sweep field: " + field);
+            }
+        }
+        configs.push_back(config);
+    }
+    return configs;
+}
+
+template <typename T>
+static void writeNpy(const path &filename, const vector<T> &data, const string &descr, size_t numCols = 1)
+{
+    string shape = numCols == 1 ? "(" + to_string(data.size()) + ",)"
+                                : "(" + to_string(data.size() / numCols) + ", " + to_string(numCols) + ")";
+    string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+    header.append(63 - (10 + header.size()) % 64, ' ').push_back('\n'); // pad to 64B alignment
+    uint16_t headerLen = header.size();
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    file.write("\x93NUMPY\x01\x00", 8).write((const char *)&headerLen, sizeof(uint16_t)).write(header.data(), header.size());
+    file.write((const char *)data.data(), data.size() * sizeof(T));
+}
+
+static void writeResult(const path &dir, const Spike *result, IntResult numResult, bool localize)
+{
+    vector<int32_t> sampleInd(numResult), channelInd(numResult);
+    vector<IntVolt> amplitude(numResult);
+    vector<float> location((size_t)numResult * 2);
+    for (IntResult i = 0; i < numResult; i++)
+    {
+        sampleInd[i] = result[i].frame;
+        channelInd[i] = result[i].channel;
+        amplitude[i] = result[i].amplitude;
+        location[i * 2] = result[i].position.x;
+        location[i * 2 + 1] = result[i].position.y;
+    }
+    writeNpy(dir / "sample_ind.npy", sampleInd, "<i4");
+    writeNpy(dir / "channel_ind.npy", channelInd, "<i4");
+    writeNpy(dir / "amplitude.npy", amplitude, voltDescr);
+    if (localize)
+    {
+        writeNpy(dir / "location.npy", location, "<f4", 2);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc != 5)
+    {
+        fprintf(stderr, "usage: %s <config> <probe> <data> <output_dir>\n", argv[0]);
+        fprintf(stderr, "  config: lines of key = value, with the keys of HSDetection params and\n");
+        fprintf(stderr, "          sampling_frequency (required), dtype and offset for flat binary\n");
+        fprintf(stderr, "  probe:  lines of x y positions for each channel\n");
+        fprintf(stderr, "  data:   .mda file, or flat binary of interleaved samples\n");
+        fprintf(stderr, "  output: .npy columns of spikes, and spike_shape.bin (.hsz if compressed,\n");
+        fprintf(stderr, "          with spike_shape.channels.bin for neighbor_shape) if saved,\n");
+        fprintf(stderr, "          and those of each sweep config k in sweep<k>/ and spike_shape.sweep<k>.bin,\n");
+        fprintf(stderr, "          or spikes.hst (spikes.sweep<k>.hst) instead of .npy with spike_table,\n");
+        fprintf(stderr, "          and artifacts.npy of blanked [start, end) frames with artifact_fraction\n");
+        return 2;
+    }
+
+    try
+    {
+        map<string, string> params = readConfig(argv[1]);
+        vector<FloatGeom> positions = readProbe(argv[2]);
+        IntChannel numChannels = positions.size() / 2;
+
+        path dataPath(argv[3]);
+        TraceReader *pReader = dataPath.extension() == ".mda"
+                                   ? (TraceReader *)new MdaReader(dataPath.string())
+                                   : (TraceReader *)new BinaryReader(dataPath.string(), numChannels, params["dtype"],
+                                                                     stoll(params["offset"]));
+        if (pReader->getNumChannels() != numChannels)
+        {
+            throw runtime_error("data has " + to_string(pReader->getNumChannels()) +
+                                " channels, probe has " + to_string(numChannels));
+        }
+        IntFrame numFrames = pReader->getNumFrames();
+
+        path outDir(argv[4]);
+        create_directories(outDir);
+
+        double fps = stod(params["sampling_frequency"]);
+        auto toFrames = [fps](const string &ms)
+        { return (IntFrame)(stod(ms) * fps / 1000 + 0.5); };
+
+        IntFrame chunkSize = stoi(params["chunk_size"]);
+        bool rescale = toBool(params["rescale"]);
+        bool verbose = toBool(params["verbose"]);
+        bool detectBadChannels = toBool(params["detect_bad_channels"]);
+        vector<array<FloatRaw, 3>> quantiles;
+        if (rescale || detectBadChannels)
+        {
+            quantiles = calibrate(*pReader);
+        }
+
+        vector<FloatRaw> scale(numChannels, 1), offset(numChannels, 0);
+        if (rescale)
+        {
+            FloatRaw rescaleValue = stof(params["rescale_value"]);
+            for (IntChannel c = 0; c < numChannels; c++)
+            {
+                scale[c] = rescaleValue / (quantiles[c][2] - quantiles[c][0]);
+                offset[c] = -quantiles[c][1] * scale[c];
+            }
+        }
+
+        unique_ptr<bool[]> channelMask(new bool[numChannels]()); // true for channels left out
+        istringstream badChannels(params["bad_channels"]);
+        for (string index; getline(badChannels, index, ',');)
+        {
+            if (trim(index).empty())
+            {
+                continue;
+            }
+            IntChannel channel = stoi(index);
+            if (channel < 0 || channel >= numChannels)
+            {
+                throw runtime_error("bad channel " + index + " out of range");
+            }
+            channelMask[channel] = true;
+        }
+        if (detectBadChannels)
+        {
+            findBadChannels(quantiles, channelMask.get());
+        }
+        IntChannel numMasked = count(channelMask.get(), channelMask.get() + numChannels, true);
+        if (verbose && numMasked > 0)
+        {
+            fprintf(stderr, "hs-detect: %d bad channels left out\n", numMasked);
+        }
+        bool localize = toBool(params["localize"]);
+        bool saveShape = toBool(params["save_shape"]);
+        bool compressShape = toBool(params["compress_shape"]);
+        IntFrame cutoutStart = toFrames(params["left_cutout_time"]);
+        IntFrame cutoutEnd = toFrames(params["right_cutout_time"]);
+        DetectionConfig mainConfig = {stof(params["threshold"]), stof(params["min_avg_amp"]), stof(params["AHP_thr"]),
+                                      toFrames(params["peak_jitter"])};
+        vector<DetectionConfig> sweepConfigs = parseSweep(params["sweep"], mainConfig, toFrames);
+        bool spikeTable = toBool(params["spike_table"]);
+        FloatRatio artifactFraction = stof(params["artifact_fraction"]);
+
+        Detection *pDet = new Detection(numChannels, chunkSize, 0, toBool(params["numa_aware"]),
+                                        rescale, scale.data(), offset.data(),
+                                        params["common_reference"] == "median",
+                                        params["common_reference"] == "average",
+                                        toFrames(params["spike_duration"]), toFrames(params["amp_avg_duration"]),
+                                        mainConfig.threshold, mainConfig.minAvgAmp, mainConfig.maxAHPAmp,
+                                        positions.data(),
+                                        stof(params["neighbor_radius"]) + radiusEps,
+                                        stof(params["inner_radius"]) + radiusEps,
+                                        mainConfig.temporalJitter, toFrames(params["rise_duration"]),
+                                        toBool(params["decay_filtering"]), stof(params["decay_ratio"]), localize,
+                                        saveShape, (outDir / (compressShape ? "spike_shape.hsz" : "spike_shape.bin")).string(),
+                                        cutoutStart, cutoutEnd, compressShape,
+                                        toBool(params["neighbor_shape"]),
+                                        numMasked > 0 ? channelMask.get() : nullptr, sweepConfigs,
+                                        spikeTable ? (outDir / "spikes.hst").string() : "", artifactFraction);
+
+        // snapshot every interval of wall time, resumed from by a run of the same config and output
+        path checkpoint(params["checkpoint_file"]);
+        double checkpointInterval = stod(params["checkpoint_interval"]);
+        IntFrame firstFrame = 0;
+        if (!checkpoint.empty() && exists(checkpoint))
+        {
+            pDet->loadState(checkpoint.string());
+            firstFrame = pDet->getNextFrame();
+            if (verbose)
+            {
+                fprintf(stderr, "hs-detect: resuming from frame %d of %s\n", firstFrame, checkpoint.c_str());
+            }
+        }
+        else if (toBool(params["fast_init"]))
+        {
+            IntFrame initLen = min((IntFrame)fps, numFrames);
+            vector<FloatRaw> initData((size_t)initLen * numChannels);
+            pReader->read(initData.data(), 0, initLen);
+            pDet->initEstimation(initData.data(), initLen);
+        }
+        auto checkpointTime = chrono::steady_clock::now();
+        IntResult numDiscarded = 0; // spikes already in the table
+
+        for (IntFrame chunkStart = firstFrame; chunkStart < numFrames; chunkStart += chunkSize)
+        {
+            IntFrame chunkLen = min(chunkSize, numFrames - chunkStart);
+            if (verbose)
+            {
+                fprintf(stderr, "hs-detect: frames from %8d to %8d (%.1f%%)\n",
+                        chunkStart, chunkStart + chunkLen, 100.0 * chunkStart / numFrames);
+            }
+            pDet->stepFrom(*pReader, chunkStart, chunkLen);
+            if (spikeTable) // memory bounded by a chunk of spikes
+            {
+                numDiscarded += pDet->getNumResult();
+                pDet->discardResult();
+            }
+
+            if (!checkpoint.empty() && chunkStart + chunkLen < numFrames &&
+                chrono::duration<double>(chrono::steady_clock::now() - checkpointTime).count() >= checkpointInterval)
+            {
+                path partial = checkpoint.string() + ".partial"; // replaced as a whole, never left half written
+                pDet->saveState(partial.string());
+                rename(partial, checkpoint);
+                checkpointTime = chrono::steady_clock::now();
+            }
+        }
+
+        IntResult numResult = pDet->finish();
+        for (int config = 1; config < pDet->getNumConfigs() && !spikeTable; config++)
+        {
+            path sweepDir = outDir / ("sweep" + to_string(config));
+            create_directories(sweepDir);
+            writeResult(sweepDir, pDet->getResult(config), pDet->getNumResult(config), localize);
+            if (verbose)
+            {
+                fprintf(stderr, "hs-detect: %d spikes detected with sweep config %d\n",
+                        pDet->getNumResult(config), config);
+            }
+        }
+
+        if (!spikeTable)
+        {
+            writeResult(outDir, pDet->getResult(), numResult, localize);
+        }
+        numResult += numDiscarded;
+        if (verbose)
+        {
+            fprintf(stderr, "hs-detect: buffers in %.1f MiB of %s pages\n",
+                    pDet->getFootprint() / 1048576.0, pDet->getPageKind());
+        }
+
+        if (artifactFraction > 0)
+        {
+            const IntFrame *artifacts = pDet->getArtifacts();
+            IntResult numArtifacts = pDet->getNumArtifacts();
+            writeNpy(outDir / "artifacts.npy", vector<int32_t>(artifacts, artifacts + numArtifacts * 2), "<i4", 2);
+            if (verbose)
+            {
+                fprintf(stderr, "hs-detect: %d artifacts blanked\n", numArtifacts);
+            }
+        }
+
+        delete pDet; // closes shape and table files
+        delete pReader;
+
+        if (!checkpoint.empty())
+        {
+            remove(checkpoint); // done, not to be resumed
+        }
+
+        if (verbose)
+        {
+            fprintf(stderr, "hs-detect: %d spikes detected in %d frames\n", numResult, numFrames);
+        }
+    }
+    catch (const exception &e)
+    {
+        fprintf(stderr, "hs-detect: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
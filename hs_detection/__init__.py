@@ -1,4 +1,6 @@
 from .detect.detect import HSDetection
+from .spike_table import SpikeTable
 from .version import version as __version__
+from .workers import SharedRecording, detect_parallel
 
-__all__ = ['HSDetection', '__version__']
+__all__ = ['HSDetection', 'SharedRecording', 'SpikeTable', 'detect_parallel', '__version__']
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "Arena.h"
+
+using namespace std;
+
+namespace HSDetection
+{
+#if !defined(_WIN32) && defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    // whether advised ranges may get transparent huge pages, i.e. the mode is [always] or [madvise],
+    // madvise itself succeeds even if the mode is [never]
+    static bool transparentHugeEnabled()
+    {
+        ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+        string modes;
+        getline(file, modes);
+        return modes.find("[always]") != string::npos || modes.find("[madvise]") != string::npos;
+    }
+#endif
+
+    Arena::~Arena()
+    {
+        if (base == nullptr)
+        {
+            return;
+        }
+#ifdef _WIN32
+        operator delete[](base, align_val_t(aliasPeriod));
+#else
+        munmap(base, capacity);
+#endif
+    }
+
+    void *Arena::allocateBytes(IntCalc bytes)
+    {
+        // next start at the slot of this buffer in 4K, so that rows of different buffers at the same frame
+        // (e.g. trace and baseline) never share the low 12 bits of address
+        IntCalc slot = numBuffers++ % (aliasPeriod / bufferAlign) * bufferAlign;
+        IntCalc start = used + (slot - used % aliasPeriod + aliasPeriod) % aliasPeriod;
+        used = start + bytes;
+
+        if (pageKind == NotMapped)
+        {
+            return nullptr;
+        }
+        if (used > capacity)
+        {
+            throw logic_error("Arena: layout differs from the one counted");
+        }
+        return base + start;
+    }
+
+    void Arena::map(bool hugePages)
+    {
+        if (pageKind != NotMapped)
+        {
+            throw logic_error("Arena: already mapped");
+        }
+        capacity = max(used, (IntCalc)1);
+        used = 0;
+        numBuffers = 0;
+
+#ifdef _WIN32
+        base = new (align_val_t(aliasPeriod)) char[capacity];
+        pageKind = HeapPages;
+        (void)hugePages;
+#else
+        if (hugePages)
+        {
+            capacity = (capacity + hugePageSize - 1) / hugePageSize * hugePageSize; // last huge page whole
+        }
+
+#ifdef MAP_HUGETLB
+        if (hugePages) // reserved at mapping, so no fault later if the pool runs out
+        {
+#ifdef MAP_HUGE_2MB
+            constexpr int hugeFlags = MAP_HUGETLB | MAP_HUGE_2MB;
+#else
+            constexpr int hugeFlags = MAP_HUGETLB;
+#endif
+            void *mapped = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | hugeFlags, -1, 0);
+            if (mapped != MAP_FAILED)
+            {
+                base = (char *)mapped;
+                pageKind = ExplicitHugePages;
+                return;
+            }
+        }
+#endif
+
+        // a huge page more, trimmed to start on a huge page boundary, so that all of it can be huge
+        IntCalc padding = hugePages ? hugePageSize : 0;
+        void *mapped = mmap(nullptr, capacity + padding, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+        {
+            capacity = 0;
+            throw bad_alloc();
+        }
+        base = (char *)mapped;
+        if (padding > 0)
+        {
+            IntCalc head = (-(uintptr_t)mapped) % hugePageSize;
+            if (head > 0)
+            {
+                munmap(mapped, head);
+            }
+            munmap(base + head + capacity, padding - head);
+            base += head;
+        }
+
+        pageKind = SmallPages;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+        if (madvise(base, capacity, hugePages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) == 0 && hugePages &&
+            transparentHugeEnabled())
+        {
+            pageKind = TransparentHugePages;
+        }
+#endif
+#endif
+    }
+
+    const char *Arena::getPageName() const
+    {
+        switch (pageKind)
+        {
+        case HeapPages:
+            return "heap";
+        case SmallPages:
+            return "small";
+        case TransparentHugePages:
+            return "advised transparent huge"; // not verified to be backed
+        case ExplicitHugePages:
+            return "explicit huge";
+        default:
+            return "none";
+        }
+    }
+
+} // namespace HSDetection
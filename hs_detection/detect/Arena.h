@@ -0,0 +1,61 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "Types.h"
+
+namespace HSDetection
+{
+    // one mapping for all the fixed-size buffers of an owner, on huge pages if available,
+    // so that the buffers read together in the inner loops take few TLB entries
+    // laid out twice the same way: a dry run counts the bytes, then map() and the real run hand out pointers
+    class Arena
+    {
+    public:
+        enum PageKind
+        {
+            NotMapped,            // still counting
+            HeapPages,            // no mmap on the platform, from aligned operator new
+            SmallPages,           // huge pages not wanted (placed by small page) or not available
+            TransparentHugePages, // advised with THP enabled, backed by huge pages only as the kernel assembles them
+            ExplicitHugePages     // from the pool reserved by the admin (vm.nr_hugepages)
+        };
+
+    private:
+        static constexpr IntCalc bufferAlign = 512;       // align to 4K/8, each buffer starting at its own slot
+        static constexpr IntCalc aliasPeriod = 4096;      // loads and stores at the same offset in 4K falsely conflict
+        static constexpr IntCalc hugePageSize = 2 << 20;  // the usual huge page of x86 and arm64
+
+        char *base;         // all the buffers, created and released here, nullptr while counting
+        IntCalc capacity;   // bytes mapped
+        IntCalc used;       // bytes laid out so far, including padding
+        IntCalc numBuffers; // buffers laid out so far, to stagger them within 4K
+        PageKind pageKind;
+
+        void *allocateBytes(IntCalc bytes);
+
+    public:
+        Arena() : base(nullptr), capacity(0), used(0), numBuffers(0), pageKind(NotMapped) {}
+        ~Arena();
+
+        // copy constructor deleted to protect buffer
+        Arena(const Arena &) = delete;
+        // copy assignment deleted to protect buffer
+        Arena &operator=(const Arena &) = delete;
+
+        // map the bytes counted so far, and restart the layout for the real run
+        // small pages if not hugePages, e.g. so that first touch places each 4K page on its NUMA node
+        void map(bool hugePages);
+
+        // uninitialized, nullptr while counting, valid until the arena is released
+        template <typename T>
+        T *allocate(IntCalc count) { return static_cast<T *>(allocateBytes(count * sizeof(T))); }
+
+        IntCalc getCapacity() const { return capacity; }
+        IntCalc getUsed() const { return used; }
+        PageKind getPageKind() const { return pageKind; }
+        const char *getPageName() const;
+    };
+
+} // namespace HSDetection
+
+#endif
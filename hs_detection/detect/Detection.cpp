@@ -1,15 +1,87 @@
 #include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <new>
 #include <numeric>
+#include <stdexcept>
+#include <thread>
 
 #include <omp.h>
 
 #include "Detection.h"
+#include "Snapshot.h"
+#include "TraceReader/TraceReader.h"
 
 using namespace std;
 
 namespace HSDetection
 {
-    Detection::Detection(IntChannel numChannels, IntFrame chunkSize, IntFrame chunkLeftMargin,
+    static IntChannel countInUse(IntChannel numInputChannels, const bool *channelMask)
+    {
+        if (channelMask == nullptr)
+        {
+            return numInputChannels;
+        }
+
+        IntChannel numChannels = count(channelMask, channelMask + numInputChannels, false);
+        if (numChannels == 0)
+        {
+            throw invalid_argument("Detection: all channels are masked");
+        }
+        return numChannels;
+    }
+
+    // x,y of the channels in use, so that the layout (and neighbors) has no masked channel
+    static vector<FloatGeom> positionsInUse(IntChannel numInputChannels, const FloatGeom *channelPositions,
+                                            const bool *channelMask)
+    {
+        vector<FloatGeom> positions;
+        for (IntChannel i = 0; i < numInputChannels; i++)
+        {
+            if (channelMask == nullptr || !channelMask[i])
+            {
+                positions.push_back(channelPositions[2 * i]);
+                positions.push_back(channelPositions[2 * i + 1]);
+            }
+        }
+        return positions;
+    }
+
+    // the main config from the scalar params, followed by the sweep
+    static vector<DetectionConfig> allConfigs(FloatRatio threshold, FloatRatio minAvgAmp, FloatRatio maxAHPAmp,
+                                              IntFrame temporalJitter, const vector<DetectionConfig> &sweepConfigs)
+    {
+        vector<DetectionConfig> configs{{threshold, minAvgAmp, maxAHPAmp, temporalJitter}};
+        configs.insert(configs.end(), sweepConfigs.begin(), sweepConfigs.end());
+        return configs;
+    }
+
+    // frames kept before each chunk, enough for the queue of any config
+    static IntFrame maxHistoryLen(IntFrame spikeDur, IntFrame riseDur, IntFrame cutoutStart, IntFrame cutoutEnd,
+                                  const vector<DetectionConfig> &configs)
+    {
+        IntFrame historyLen = 0;
+        for (const DetectionConfig &config : configs)
+        {
+            historyLen = max(historyLen, SpikeQueue::getHistoryLen(spikeDur, riseDur, config.temporalJitter,
+                                                                   cutoutStart, cutoutEnd));
+        }
+        return historyLen;
+    }
+
+    // channels crossing at once for a frame to be an artifact, at least one so that quiet frames never are
+    static IntChannel countArtifactChannels(FloatRatio artifactFraction, IntChannel numChannels)
+    {
+        if (artifactFraction < 0 || artifactFraction > 1)
+        {
+            throw invalid_argument("Detection: artifact fraction should be within [0, 1]");
+        }
+        return artifactFraction == 0 ? 0 : max((IntChannel)ceil(artifactFraction * numChannels), (IntChannel)1);
+    }
+
+    Detection::Detection(IntChannel numInputChannels, IntFrame chunkSize, IntFrame chunkLeftMargin, bool numaAware,
                          bool rescale, const FloatRaw *scale, const FloatRaw *offset,
                          bool medianReference, bool averageReference,
                          IntFrame spikeDur, IntFrame ampAvgDur,
@@ -17,105 +89,749 @@ namespace HSDetection
                          const FloatGeom *channelPositions, FloatGeom neighborRadius, FloatGeom innerRadius,
                          IntFrame temporalJitter, IntFrame riseDur,
                          bool decayFiltering, FloatRatio decayRatio, bool localize,
-                         bool saveShape, string filename, IntFrame cutoutStart, IntFrame cutoutEnd)
-        : traceRaw(chunkLeftMargin, numChannels, chunkSize),
-          numChannels(numChannels), alignedChannels(alignChannel(numChannels)),
-          chunkSize(chunkSize), chunkLeftMargin(chunkLeftMargin), rescale(rescale),
-          scale(new (align_val_t(channelAlign * sizeof(IntVolt))) FloatRaw[alignedChannels * channelAlign]),
-          offset(new (align_val_t(channelAlign * sizeof(IntVolt))) FloatRaw[alignedChannels * channelAlign]),
-          trace(chunkSize + chunkLeftMargin, alignedChannels * channelAlign),
+                         bool saveShape, string filename, IntFrame cutoutStart, IntFrame cutoutEnd,
+                         bool compressShape, bool neighborShape, const bool *channelMask,
+                         const vector<DetectionConfig> &sweepConfigs, const string &tableFilename,
+                         FloatRatio artifactFraction)
+        : arena(), inputArena(), traceRaw(numInputChannels), inputBuffer(nullptr),
+          numInputChannels(numInputChannels), numChannels(countInUse(numInputChannels, channelMask)),
+          alignedChannels(alignChannel(numChannels)), inputChannels(nullptr),
+          masked(numChannels < numInputChannels),
+          chunkSize(chunkSize), chunkLeftMargin(chunkLeftMargin),
+          historyLen(maxHistoryLen(spikeDur, riseDur, cutoutStart, cutoutEnd,
+                                   allConfigs(threshold, minAvgAmp, maxAHPAmp, temporalJitter, sweepConfigs))),
+          numThreads(omp_get_max_threads()), numaAware(numaAware), rebalance(!numaAware),
+          threadChannelSpan(numThreads + 1),
+          channelCrossings(nullptr), balanceFrames(0),
+          castProgress(nullptr), rescale(rescale), scale(nullptr), offset(nullptr),
+          trace(chunkSize + historyLen, alignedChannels * channelAlign),
           medianReference(medianReference), averageReference(averageReference),
-          commonRef(chunkSize + chunkLeftMargin, 1),
-          runningBaseline(chunkSize + chunkLeftMargin, alignedChannels * channelAlign),
-          runningDeviation(chunkSize + chunkLeftMargin, alignedChannels * channelAlign),
-          spikeTime(new IntFrame[numChannels]), spikeAmp(new IntVolt[numChannels]),
-          spikeArea(new IntCalc[numChannels]), hasAHP(new bool[numChannels]),
-          spikeDur(spikeDur), ampAvgDur(ampAvgDur), threshold(threshold * thrQuant),
-          minAvgAmp(minAvgAmp * thrQuant), maxAHPAmp(maxAHPAmp * thrQuant),
-          probeLayout(numChannels, channelPositions, neighborRadius, innerRadius),
-          result(), temporalJitter(temporalJitter), riseDur(riseDur),
+          commonRef(chunkSize + historyLen, 1),
+          runningBaseline(chunkSize + historyLen, alignedChannels * channelAlign),
+          runningDeviation(chunkSize + historyLen, alignedChannels * channelAlign),
+          artifactChannels(countArtifactChannels(artifactFraction, numChannels)),
+          artifactLevel(nullptr),
+          artifactFlag(artifactChannels > 0 ? chunkSize + historyLen : 1, 1), artifacts(), artifactStart(-1),
+          configs(allConfigs(threshold, minAvgAmp, maxAHPAmp, temporalJitter, sweepConfigs)),
+          numConfigs(configs.size()),
+          spikeTime(nullptr), spikeAmp(nullptr), spikeArea(nullptr), hasAHP(nullptr),
+          spikeDur(spikeDur), ampAvgDur(ampAvgDur), threshold(), minAvgAmp(), maxAHPAmp(), queues(),
+          probeLayout(numChannels, positionsInUse(numInputChannels, channelPositions, channelMask).data(),
+                      neighborRadius, innerRadius),
+          results(numConfigs), stepLatency(0), nextFrame(0), stats(), riseDur(riseDur),
           decayFilter(decayFiltering), decayRatio(decayRatio), localize(localize),
-          saveShape(saveShape), filename(filename), cutoutStart(cutoutStart), cutoutEnd(cutoutEnd)
+          saveShape(saveShape), filename(filename), cutoutStart(cutoutStart), cutoutEnd(cutoutEnd),
+          compressShape(compressShape), neighborShape(neighborShape), tableFilename(tableFilename)
     {
+        placeBuffers();        // dry run for the size
+        arena.map(!numaAware); // huge pages would be placed whole on the node of the thread touching first
+        placeBuffers();        // same layout in the mapping
+        for (int i = 0; i < numThreads; i++)
+        {
+            new (&castProgress[i]) CastProgress();
+        }
+
+        for (IntChannel i = 0, channel = 0; channel < numInputChannels; channel++)
+        {
+            if (channelMask == nullptr || !channelMask[channel])
+            {
+                inputChannels[i++] = channel;
+            }
+        }
+        fill(inputChannels + numChannels, inputChannels + alignedChannels * channelAlign, 0); // padding read but unused
+
+        fill_n(channelCrossings, alignedChannels * channelAlign, 0);
+        balancePartition(); // equal lanes for each thread before any crossing is counted
+
+        if (numaAware)
+        {
+#pragma omp parallel num_threads(numThreads) proc_bind(spread)
+            firstTouch();
+        }
+
         fill_n(this->scale, alignedChannels * channelAlign, (FloatRaw)1);
         fill_n(this->offset, alignedChannels * channelAlign, (FloatRaw)0);
         if (rescale)
         {
-            copy_n(scale, numChannels, this->scale);
-            copy_n(offset, numChannels, this->offset);
+            for (IntChannel i = 0; i < numChannels; i++)
+            {
+                this->scale[i] = scale[inputChannels[i]];
+                this->offset[i] = offset[inputChannels[i]];
+            }
         }
 
         fill_n(runningBaseline[-1], alignedChannels * channelAlign, initBase);
         fill_n(runningDeviation[-1], alignedChannels * channelAlign, initDev);
 
-        fill_n(spikeTime, numChannels, (IntFrame)-1);
+        fill_n(spikeTime, (IntCalc)numConfigs * numChannels, (IntFrame)-1);
+        fill_n(artifactLevel, alignedChannels * channelAlign, numeric_limits<IntVolt>::max()); // padding never crosses
+
+        for (const DetectionConfig &config : configs)
+        {
+            this->threshold.push_back(config.threshold * thrQuant);
+            this->minAvgAmp.push_back(config.minAvgAmp * thrQuant);
+            this->maxAHPAmp.push_back(config.maxAHPAmp * thrQuant);
+        }
+
+        stats.threads.resize(numThreads);
 
-        pQueue = new SpikeQueue(this); // all the params should be ready
+        for (int config = 0; config < numConfigs; config++)
+        {
+            queues.push_back(new SpikeQueue(this, config)); // all the params should be ready
+            queues.back()->setNumThreads(numThreads);
+        }
     }
 
     Detection::~Detection()
     {
-        delete pQueue;
+        for (SpikeQueue *pQueue : queues)
+        {
+            delete pQueue;
+        }
+
+        // buffers released with the arenas
+    }
+
+    void Detection::placeBuffers()
+    {
+        IntChannel channelWidth = alignedChannels * channelAlign;
+        IntCalc stateLen = (IntCalc)numConfigs * numChannels;
 
-        delete[] spikeTime;
-        delete[] spikeAmp;
-        delete[] spikeArea;
-        delete[] hasAHP;
+        // those read together for each frame of estimateAndDetect first, each at its own slot of 4K
+        trace.place(arena);
+        commonRef.place(arena);
+        runningBaseline.place(arena);
+        runningDeviation.place(arena);
+        artifactFlag.place(arena);
+        spikeTime = arena.allocate<IntFrame>(stateLen);
+        spikeAmp = arena.allocate<IntVolt>(stateLen);
+        spikeArea = arena.allocate<VoltCalc>(stateLen);
+        hasAHP = arena.allocate<bool>(stateLen);
 
-        operator delete[](scale, align_val_t(channelAlign * sizeof(IntVolt)));
-        operator delete[](offset, align_val_t(channelAlign * sizeof(IntVolt)));
+        inputChannels = arena.allocate<IntChannel>(channelWidth);
+        scale = arena.allocate<FloatRaw>(channelWidth);
+        offset = arena.allocate<FloatRaw>(channelWidth);
+        artifactLevel = arena.allocate<IntVolt>(channelWidth);
+        channelCrossings = arena.allocate<IntFrame>(channelWidth);
+        castProgress = arena.allocate<CastProgress>(numThreads);
     }
 
     void Detection::step(FloatRaw *traceBuffer, IntFrame chunkStart, IntFrame chunkLen)
     {
-        traceRaw.updateChunk(traceBuffer);
+        stepChunk(traceBuffer + (IntCalc)chunkLeftMargin * numInputChannels, chunkStart, chunkLen);
+    }
 
-#pragma omp parallel
+    FloatRaw *Detection::getInputBuffer()
+    {
+        if (inputBuffer == nullptr) // only allocated for the callers filling it, padded for aligned cast
         {
-            castAndCommonref(chunkStart, chunkLen);
-#pragma omp barrier
-            estimateAndDetect(chunkStart, chunkLen);
+            IntCalc inputLen = (IntCalc)chunkSize * numInputChannels + alignedChannels * channelAlign;
+            inputArena.allocate<FloatRaw>(inputLen);
+            inputArena.map(!numaAware);
+            inputBuffer = inputArena.allocate<FloatRaw>(inputLen);
         }
+        return inputBuffer;
+    }
 
-        pQueue->process();
+    void Detection::stepInput(IntFrame chunkStart, IntFrame chunkLen)
+    {
+        stepChunk(getInputBuffer(), chunkStart, chunkLen);
+    }
+
+    void Detection::stepFrom(TraceReader &reader, IntFrame chunkStart, IntFrame chunkLen)
+    {
+        reader.read(getInputBuffer(), chunkStart, chunkLen); // converted into owned input, no extra copy
+        stepInput(chunkStart, chunkLen);
+    }
+
+    void Detection::stepChunk(FloatRaw *chunkBuffer, IntFrame chunkStart, IntFrame chunkLen)
+    {
+        double startTime = omp_get_wtime();
+
+        traceRaw.updateChunk(chunkBuffer, chunkStart);
+
+        for (int i = 0; i < numThreads; i++)
+        {
+            castProgress[i].numBlocks.store(0, memory_order_relaxed); // published by start of parallel
+        }
+
+        if (artifactChannels > 0)
+        {
+            setArtifactLevel(chunkStart);
+        }
+
+        // small steps (e.g. online packets) on one thread owning all parts, not worth a fork-join
+        bool parallel = chunkLen >= minParallelLen;
+        if (numaAware) // same binding of threads to places in each step, so slices stay on the same node
+        {
+#pragma omp parallel num_threads(numThreads) proc_bind(spread) if (parallel)
+            stepInParallel(chunkStart, chunkLen);
+        }
+        else
+        {
+#pragma omp parallel num_threads(numThreads) if (parallel)
+            stepInParallel(chunkStart, chunkLen);
+        }
+
+        if (artifactChannels > 0)
+        {
+            collectArtifacts(chunkStart, chunkLen);
+        }
+
+        double queueStart = collectStats ? statsClock() : 0;
+        for (SpikeQueue *pQueue : queues)
+        {
+            pQueue->process(chunkStart + chunkLen); // spikes are emitted as soon as processing delay passed
+        }
+
+        // stable partition if NUMA aware, because the pages of slices stay on the node of first touch
+        balanceFrames += chunkLen;
+        if (rebalance && balanceFrames >= balanceLen)
+        {
+            balancePartition();
+        }
+
+        nextFrame = chunkStart + chunkLen;
+        stepLatency = omp_get_wtime() - startTime;
+
+        if constexpr (collectStats)
+        {
+            stats.numSteps++;
+            stats.numFrames += chunkLen;
+            stats.stepTime += stepLatency;
+            stats.queueTime += statsClock() - queueStart;
+        }
     }
 
     IntResult Detection::finish()
     {
-        pQueue->finalize();
-        return result.size();
+        for (SpikeQueue *pQueue : queues)
+        {
+            pQueue->finalize();
+        }
+        if (artifactStart >= 0) // blanked until the last frame
+        {
+            artifacts.push_back(artifactStart);
+            artifacts.push_back(nextFrame);
+            artifactStart = -1;
+        }
+        return results[0].size();
+    }
+
+    const Spike *Detection::getResult(int config) const
+    {
+        return results.at(config).data(); // invalidated by the next step
+    }
+
+    IntResult Detection::getNumResult(int config) const
+    {
+        return results.at(config).size(); // spikes emitted so far are final, available before finish
+    }
+
+    int Detection::getNumConfigs() const
+    {
+        return numConfigs;
+    }
+
+    void Detection::discardResult()
+    {
+        for (vector<Spike> &result : results)
+        {
+            result.clear();
+        }
+    }
+
+    const IntFrame *Detection::getArtifacts() const
+    {
+        return artifacts.data(); // invalidated by the next step
+    }
+
+    IntResult Detection::getNumArtifacts() const
+    {
+        return artifacts.size() / 2;
+    }
+
+    IntFrame Detection::getHistoryLen(IntFrame spikeDur, IntFrame riseDur, IntFrame temporalJitter,
+                                      IntFrame cutoutStart, IntFrame cutoutEnd,
+                                      const vector<DetectionConfig> &sweepConfigs)
+    {
+        return maxHistoryLen(spikeDur, riseDur, cutoutStart, cutoutEnd,
+                             allConfigs(0, 0, 0, temporalJitter, sweepConfigs)); // only jitter matters
+    }
+
+    IntCalc Detection::getFootprint() const
+    {
+        return arena.getCapacity() + inputArena.getCapacity();
+    }
+
+    const char *Detection::getPageKind() const
+    {
+        return arena.getPageName();
+    }
+
+    double Detection::getStepLatency() const
+    {
+        return stepLatency;
+    }
+
+    const DetectionStats &Detection::getStats() const
+    {
+        return stats; // all zero if compiled without HSDETECTION_STATS
+    }
+
+    IntChannel Detection::getShapeChannels() const
+    {
+        return neighborShape ? probeLayout.getMaxNeighbors() : 1; // neighborhoods padded to the largest
+    }
+
+    string Detection::getSweepFilename(const string &filename, int config)
+    {
+        filesystem::path path(filename);
+        return path.replace_extension(".sweep" + to_string(config) + path.extension().string()).string();
+    }
+
+    // counts on the sorted volts of a channel, for the balance of updates in estimation
+    static IntCalc countBelow(const vector<IntVolt> &volts, double level) // volts < level
+    {
+        return lower_bound(volts.begin(), volts.end(), level) - volts.begin();
+    }
+
+    static IntCalc countNotAbove(const vector<IntVolt> &volts, double level) // volts <= level
+    {
+        return upper_bound(volts.begin(), volts.end(), level) - volts.begin();
+    }
+
+    // baseline where steps up (dev/tauBase above dev) and down (half of it below -dev) balance, decreasing in base
+    static double balanceBaseline(const vector<IntVolt> &volts, double dev)
+    {
+        IntCalc numFrames = volts.size();
+        double low = volts.front() - dev, high = volts.back() + dev;
+        for (int i = 0; i < 48; i++)
+        {
+            double base = (low + high) / 2;
+            IntCalc up = numFrames - countNotAbove(volts, base + dev);
+            IntCalc down = countBelow(volts, base - dev);
+            if (up * 2 > down)
+            {
+                low = base;
+            }
+            else
+            {
+                high = base;
+            }
+        }
+        return (low + high) / 2;
+    }
+
+    // largest deviation where steps up (in (dev, 5dev)) and down (in (0, dev] or above 6dev) balance,
+    // the stable one when approached from above, as from initDev
+    static double balanceDeviation(const vector<IntVolt> &volts, double base, double minDev)
+    {
+        IntCalc numFrames = volts.size();
+        auto drift = [&](double dev)
+        {
+            IntCalc notAboveDev = countNotAbove(volts, base + dev);
+            IntCalc up = countBelow(volts, base + 5 * dev) - notAboveDev;
+            IntCalc down = notAboveDev - countNotAbove(volts, base) + numFrames - countNotAbove(volts, base + 6 * dev);
+            return up - down;
+        };
+
+        double high = max(base - volts.front(), volts.back() - base) + minDev; // only steps down above all volts
+        double low = high;
+        do
+        {
+            high = low, low = high / 1.25;
+            if (low <= minDev)
+            {
+                return minDev; // clamped in estimation
+            }
+        } while (drift(low) <= 0);
+
+        for (int i = 0; i < 32; i++)
+        {
+            double dev = (low + high) / 2;
+            if (drift(dev) > 0)
+            {
+                low = dev;
+            }
+            else
+            {
+                high = dev;
+            }
+        }
+        return (low + high) / 2;
+    }
+
+    static IntVolt roundVolt(double volt)
+    {
+        return is_floating_point_v<IntVolt> ? (IntVolt)volt : (IntVolt)llround(volt);
+    }
+
+    void Detection::initEstimation(const FloatRaw *traceBuffer, IntFrame numFrames)
+    {
+        if (nextFrame != 0)
+        {
+            throw runtime_error("Detection: estimation can only be initialized before the first step");
+        }
+        if (numFrames <= 0)
+        {
+            return;
+        }
+
+        // cast and reference as in steps, rows padded for the aligned cast
+        IntChannel rowLen = alignedChannels * channelAlign;
+        vector<FloatRaw> input(max(rowLen, numInputChannels), 0);
+        vector<IntVolt> frames((IntCalc)numFrames * rowLen);
+        vector<IntVolt> refs(numFrames, 0);
+        vector<IntVolt> medianBuffer(numChannels);
+        for (IntFrame t = 0; t < numFrames; t++)
+        {
+            copy_n(traceBuffer + (IntCalc)t * numInputChannels, numInputChannels, input.data());
+            IntVolt *row = frames.data() + (IntCalc)t * rowLen;
+            if (rescale)
+            {
+                scaleCast(row, input.data());
+            }
+            else
+            {
+                noscaleCast(row, input.data());
+            }
+            if (medianReference)
+            {
+                commonMedian(&refs[t], row, medianBuffer.data(), numChannels / 2);
+            }
+            else if (averageReference)
+            {
+                commonAverage(&refs[t], row);
+            }
+        }
+
+        IntVolt *baselines = runningBaseline[nextFrame - 1];
+        IntVolt *deviations = runningDeviation[nextFrame - 1];
+
+        // channels independent, each solved on its sorted volts by alternating the two balances
+#pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+        for (IntChannel i = 0; i < numChannels; i++)
+        {
+            vector<IntVolt> volts(numFrames);
+            for (IntFrame t = 0; t < numFrames; t++)
+            {
+                volts[t] = frames[(IntCalc)t * rowLen + i] - refs[t];
+            }
+            sort(volts.begin(), volts.end());
+
+            double base = volts[numFrames / 2];
+            double dev = balanceDeviation(volts, base, minDev);
+            for (int k = 0; k < 4; k++)
+            {
+                base = balanceBaseline(volts, dev);
+                dev = balanceDeviation(volts, base, minDev);
+            }
+
+            baselines[i] = roundVolt(base);
+            deviations[i] = roundVolt(dev);
+        }
+    }
+
+    // rows still read after a chunk boundary: historyLen frames before it and the previous row of the first
+    static void saveRows(ostream &out, const RollingArray &array, IntFrame frameStart, IntFrame frameEnd)
+    {
+        for (IntFrame frame = frameStart; frame < frameEnd; frame++)
+        {
+            Snapshot::write(out, array[frame], array.getNumChannels());
+        }
+    }
+
+    static void loadRows(istream &in, RollingArray &array, IntFrame frameStart, IntFrame frameEnd)
+    {
+        for (IntFrame frame = frameStart; frame < frameEnd; frame++)
+        {
+            Snapshot::read(in, array[frame], array.getNumChannels());
+        }
+    }
+
+    void Detection::saveState(const string &filename)
+    {
+        ofstream out(filename, ios::binary | ios::trunc);
+        if (!out)
+        {
+            throw runtime_error("Detection: cannot write snapshot " + filename);
+        }
+
+        // params that shape the state, checked on load
+        Snapshot::write(out, Snapshot::magic, sizeof(Snapshot::magic));
+        Snapshot::write(out, (IntCalc)sizeof(IntVolt));
+        Snapshot::write(out, numInputChannels);
+        Snapshot::write(out, numChannels);
+        Snapshot::write(out, inputChannels, numChannels);
+        Snapshot::write(out, chunkSize);
+        Snapshot::write(out, historyLen);
+        Snapshot::write(out, saveShape);
+        Snapshot::write(out, numConfigs);
+        Snapshot::write(out, !tableFilename.empty());
+        Snapshot::write(out, artifactChannels);
+
+        Snapshot::write(out, nextFrame);
+        Snapshot::write(out, scale, numChannels); // calibration may be random, keep the one in use
+        Snapshot::write(out, offset, numChannels);
+
+        IntFrame rowStart = nextFrame - historyLen - 1;
+        saveRows(out, trace, rowStart, nextFrame);
+        saveRows(out, commonRef, rowStart, nextFrame);
+        saveRows(out, runningBaseline, rowStart, nextFrame);
+        saveRows(out, runningDeviation, rowStart, nextFrame);
+
+        Snapshot::write(out, spikeTime, (IntCalc)numConfigs * numChannels);
+        Snapshot::write(out, spikeAmp, (IntCalc)numConfigs * numChannels);
+        Snapshot::write(out, spikeArea, (IntCalc)numConfigs * numChannels);
+        Snapshot::write(out, hasAHP, (IntCalc)numConfigs * numChannels);
+
+        Snapshot::write(out, channelCrossings, alignedChannels * channelAlign);
+        Snapshot::write(out, balanceFrames);
+
+        Snapshot::write(out, (IntCalc)artifacts.size());
+        Snapshot::write(out, artifacts.data(), artifacts.size());
+        Snapshot::write(out, artifactStart);
+
+        for (int config = 0; config < numConfigs; config++)
+        {
+            Snapshot::write(out, (IntCalc)results[config].size());
+            for (const Spike &spike : results[config])
+            {
+                Snapshot::writeSpike(out, spike);
+            }
+
+            queues[config]->saveState(out); // spikes waiting and offsets of shape files
+        }
+
+        if (!out.flush())
+        {
+            throw runtime_error("Detection: cannot write snapshot " + filename);
+        }
+    }
+
+    void Detection::loadState(const string &filename)
+    {
+        ifstream in(filename, ios::binary);
+        if (!in)
+        {
+            throw runtime_error("Detection: cannot read snapshot " + filename);
+        }
+
+        char magic[sizeof(Snapshot::magic)];
+        Snapshot::read(in, magic, sizeof(magic));
+        if (!equal(magic, magic + sizeof(magic), Snapshot::magic))
+        {
+            throw runtime_error("Detection: not a snapshot " + filename);
+        }
+        Snapshot::check(in, (IntCalc)sizeof(IntVolt), "precision");
+        Snapshot::check(in, numInputChannels, "number of channels");
+        Snapshot::check(in, numChannels, "number of channels in use");
+        for (IntChannel i = 0; i < numChannels; i++)
+        {
+            Snapshot::check(in, inputChannels[i], "channel mask");
+        }
+        Snapshot::check(in, chunkSize, "chunk size");
+        Snapshot::check(in, historyLen, "history length");
+        Snapshot::check(in, saveShape, "shape saving");
+        Snapshot::check(in, numConfigs, "number of configs");
+        Snapshot::check(in, !tableFilename.empty(), "table writing");
+        Snapshot::check(in, artifactChannels, "artifact blanking");
+
+        nextFrame = Snapshot::read<IntFrame>(in);
+        Snapshot::read(in, scale, numChannels);
+        Snapshot::read(in, offset, numChannels);
+
+        IntFrame rowStart = nextFrame - historyLen - 1;
+        loadRows(in, trace, rowStart, nextFrame);
+        loadRows(in, commonRef, rowStart, nextFrame);
+        loadRows(in, runningBaseline, rowStart, nextFrame);
+        loadRows(in, runningDeviation, rowStart, nextFrame);
+
+        Snapshot::read(in, spikeTime, (IntCalc)numConfigs * numChannels);
+        Snapshot::read(in, spikeAmp, (IntCalc)numConfigs * numChannels);
+        Snapshot::read(in, spikeArea, (IntCalc)numConfigs * numChannels);
+        Snapshot::read(in, hasAHP, (IntCalc)numConfigs * numChannels);
+
+        Snapshot::read(in, channelCrossings, alignedChannels * channelAlign);
+        balanceFrames = Snapshot::read<IntFrame>(in);
+
+        artifacts.resize(Snapshot::read<IntCalc>(in));
+        Snapshot::read(in, artifacts.data(), artifacts.size());
+        artifactStart = Snapshot::read<IntFrame>(in);
+
+        for (int config = 0; config < numConfigs; config++)
+        {
+            results[config].clear();
+            for (IntCalc i = Snapshot::read<IntCalc>(in); i > 0; i--)
+            {
+                results[config].push_back(Snapshot::readSpike(in));
+            }
+
+            queues[config]->loadState(in);
+        }
+    }
+
+    IntFrame Detection::getNextFrame() const
+    {
+        return nextFrame;
+    }
+
+    void Detection::balancePartition()
+    {
+        // cost of each lane in the frames since last rebalance, spikes cost more in the state machine of detection
+        // cut at lanes rather than cache lines, so that e.g. 384 channels of int16 (12 lines) still feed 16 threads;
+        // a cut inside a line makes the two threads write its halves in each row of baseline and deviation,
+        // which is false sharing on one line per cut and row, against whole threads left idle at line granularity
+        IntChannel numLanes = alignedChannels * channelAlign / laneAlign;
+        vector<IntCalc> laneCost(numLanes);
+        for (IntChannel lane = 0; lane < numLanes; lane++)
+        {
+            IntCalc crossings = accumulate(channelCrossings + lane * laneAlign,
+                                           channelCrossings + (lane + 1) * laneAlign, (IntCalc)0);
+            IntChannel channels = max(min(laneAlign, numChannels - lane * laneAlign), 0);
+            laneCost[lane] = (IntCalc)max(balanceFrames, 1) * (laneAlign + channels) + // estimation on all, detection on actual
+                             crossings * spikeDur * crossingCost;
+        }
+
+        // contiguous parts in ascending channels (the queue merges on that), cut where prefix cost passes each share
+        IntCalc totalCost = accumulate(laneCost.begin(), laneCost.end(), (IntCalc)0);
+        IntCalc prefixCost = 0;
+        IntChannel lane = 0;
+        threadChannelSpan[0] = 0;
+        for (int part = 0; part < numThreads; part++)
+        {
+            IntCalc shareEnd = totalCost * (part + 1) / numThreads;
+            // take the next lane if it ends nearer to the share than stopping here
+            while (lane < numLanes && prefixCost + laneCost[lane] / 2 < shareEnd)
+            {
+                prefixCost += laneCost[lane++];
+            }
+            threadChannelSpan[part + 1] = lane * laneAlign;
+        }
+        threadChannelSpan[numThreads] = numLanes * laneAlign;
+
+        fill_n(channelCrossings, alignedChannels * channelAlign, 0);
+        balanceFrames = 0;
     }
 
-    const Spike *Detection::getResult() const
+    void Detection::firstTouch()
     {
-        return result.data();
+        int threadNum = omp_get_thread_num();
+        IntChannel thChannelStart = threadChannelSpan[threadNum];
+        IntChannel thChannelEnd = threadChannelSpan[threadNum + 1];
+
+        // the buffers mostly used by estimateAndDetect on the same partition
+        trace.firstTouch(thChannelStart, thChannelEnd);
+        runningBaseline.firstTouch(thChannelStart, thChannelEnd);
+        runningDeviation.firstTouch(thChannelStart, thChannelEnd);
     }
 
-    void Detection::castAndCommonref(IntFrame chunkStart, IntFrame chunkLen)
+    void Detection::stepInParallel(IntFrame chunkStart, IntFrame chunkLen)
     {
-        int numThreads = omp_get_num_threads();
+        int teamSize = omp_get_num_threads(); // should be numThreads, but still correct if fewer
         int threadNum = omp_get_thread_num();
-        // each thread have ceil(chunkLen / numThreads), last has fewer
-        IntFrame thChunkLen = (chunkLen + numThreads - 1) / numThreads;
-        IntFrame thChunkStart = chunkStart + threadNum * thChunkLen;
-        thChunkLen = min(thChunkLen, chunkStart + chunkLen - thChunkStart);
 
+        for (int part = threadNum; part < numThreads; part += teamSize)
+        {
+            for (SpikeQueue *pQueue : queues)
+            {
+                pQueue->reserveThread(part, max(min(threadChannelSpan[part + 1], numChannels) - threadChannelSpan[part], 0));
+            }
+        }
+
+        IntVolt *medianBuffer = medianReference ? new IntVolt[numChannels] : nullptr; // nth_element modifies container
+
+        // each block is cast by all threads on a share of its frames, one block ahead of estimation,
+        // so that the cast of the next block overlaps the estimation of this one on every thread,
+        // and estimation starts without waiting for the whole chunk and reads trace still in cache
+        IntFrame numBlocks = (chunkLen + castBlockLen - 1) / castBlockLen;
+        IntFrame shareLen = (castBlockLen + teamSize - 1) / teamSize;
+        auto castShare = [&](IntFrame block)
+        {
+            IntFrame blockStart = chunkStart + block * castBlockLen;
+            IntFrame blockLen = min(castBlockLen, chunkStart + chunkLen - blockStart);
+            IntFrame shareStart = min(threadNum * shareLen, blockLen);
+            IntFrame shareEnd = min(shareStart + shareLen, blockLen);
+            if (shareStart < shareEnd)
+            {
+                castAndCommonref(blockStart + shareStart, shareEnd - shareStart, medianBuffer);
+            }
+            castProgress[threadNum].numBlocks.store(block + 1, memory_order_release);
+        };
+
+        double castStart = collectStats ? statsClock() : 0;
+        castShare(0);
+        for (IntFrame block = 0; block < numBlocks; block++)
+        {
+            IntFrame blockStart = chunkStart + block * castBlockLen;
+            IntFrame blockLen = min(castBlockLen, chunkStart + chunkLen - blockStart);
+
+            if (block + 1 < numBlocks)
+            {
+                castShare(block + 1);
+            }
+
+            double waitStart = collectStats ? statsClock() : 0;
+            waitCast(teamSize, block + 1); // shares of this block by the others, usually done a block ago
+
+            double estimateStart = collectStats ? statsClock() : 0;
+            for (int part = threadNum; part < numThreads; part += teamSize)
+            {
+                estimateAndDetect(blockStart, blockLen, part);
+            }
+
+            if constexpr (collectStats)
+            {
+                ThreadStats &thStats = stats.threads[threadNum];
+                double estimateEnd = statsClock();
+                thStats.castTime += waitStart - castStart;
+                thStats.waitTime += estimateStart - waitStart;
+                thStats.estimateTime += estimateEnd - estimateStart;
+                castStart = estimateEnd;
+            }
+        }
+
+        delete[] medianBuffer;
+    }
+
+    void Detection::waitCast(int teamSize, IntFrame numBlocks) const
+    {
+        // spin first because handoff is usually quick, then give up the core to avoid burning it
+        for (int caster = 0; caster < teamSize; caster++)
+        {
+            for (int spin = 0; castProgress[caster].numBlocks.load(memory_order_acquire) < numBlocks; spin++)
+            {
+                if (spin >= spinLimit)
+                {
+                    this_thread::yield();
+                }
+            }
+        }
+    }
+
+    void Detection::castAndCommonref(IntFrame chunkStart, IntFrame chunkLen, IntVolt *medianBuffer)
+    {
         if (rescale && !medianReference && averageReference)
         {
-            scaleAndAverage(thChunkStart, thChunkLen);
+            scaleAndAverage(chunkStart, chunkLen);
+            if (artifactChannels > 0)
+            {
+                markArtifacts(chunkStart, chunkLen);
+            }
             return;
         }
 
         if (rescale)
         {
-            for (IntFrame t = thChunkStart; t < thChunkStart + thChunkLen; t++)
+            for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
             {
                 scaleCast(trace[t], traceRaw[t]);
             }
         }
         else
         {
-            for (IntFrame t = thChunkStart; t < thChunkStart + thChunkLen; t++)
+            for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
             {
                 noscaleCast(trace[t], traceRaw[t]);
             }
@@ -123,23 +839,77 @@ namespace HSDetection
 
         if (medianReference)
         {
-            IntVolt *buffer = new IntVolt[numChannels]; // nth_element modifies container
             IntChannel mid = numChannels / 2;
 
-            for (IntFrame t = thChunkStart; t < thChunkStart + thChunkLen; t++)
+            for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
             {
-                commonMedian(commonRef[t], trace[t], buffer, mid);
+                commonMedian(commonRef[t], trace[t], medianBuffer, mid);
             }
-
-            delete[] buffer;
         }
         else if (averageReference)
         {
-            for (IntFrame t = thChunkStart; t < thChunkStart + thChunkLen; t++)
+            for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
             {
                 commonAverage(commonRef[t], trace[t]);
             }
         }
+
+        if (artifactChannels > 0)
+        {
+            markArtifacts(chunkStart, chunkLen);
+        }
+    }
+
+    void Detection::setArtifactLevel(IntFrame chunkStart)
+    {
+        // crossing of detection on the estimation before the step, which drifts little within a chunk,
+        // so that the whole frame is judged in the cast without waiting for the estimation of all parts
+        const IntVolt *baselines = runningBaseline[chunkStart - 1];
+        const IntVolt *deviations = runningDeviation[chunkStart - 1];
+        for (IntChannel i = 0; i < numChannels; i++)
+        {
+            VoltCalc level = baselines[i] + (VoltCalc)threshold[0] * deviations[i] / thrQuant;
+            artifactLevel[i] = min(level, (VoltCalc)numeric_limits<IntVolt>::max());
+        }
+    }
+
+    void Detection::markArtifacts(IntFrame chunkStart, IntFrame chunkLen)
+    {
+        for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
+        {
+            const IntVolt *trace = this->trace[t];
+            IntVolt ref = commonRef(t, 0);
+
+            IntChannel crossing = 0;
+            for (IntChannel i = 0; i < numChannels; i++) // branchless count, vectorized
+            {
+                crossing += (IntVolt)(trace[i] - ref) > artifactLevel[i];
+            }
+            artifactFlag(t, 0) = crossing >= artifactChannels;
+        }
+    }
+
+    void Detection::collectArtifacts(IntFrame chunkStart, IntFrame chunkLen)
+    {
+        for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
+        {
+            bool blanked = artifactFlag(t, 0);
+            if (blanked && artifactStart < 0)
+            {
+                artifactStart = t;
+            }
+            else if (!blanked && artifactStart >= 0)
+            {
+                artifacts.push_back(artifactStart);
+                artifacts.push_back(t);
+                artifactStart = -1;
+            }
+
+            if constexpr (collectStats)
+            {
+                stats.numBlanked += blanked;
+            }
+        }
     }
 
     void Detection::scaleAndAverage(IntFrame chunkStart, IntFrame chunkLen)
@@ -154,6 +924,15 @@ namespace HSDetection
 
     void Detection::scaleCast(IntVolt *trace, const FloatRaw *input)
     {
+        if (masked) // gather the channels in use into the compact layout
+        {
+            for (IntChannel i = 0; i < alignedChannels * channelAlign; i++)
+            {
+                trace[i] = input[inputChannels[i]] * scale[i] + offset[i];
+            }
+            return;
+        }
+
         for (IntChannel i = 0; i < alignedChannels * channelAlign; i++)
         {
             trace[i] = input[i] * scale[i] + offset[i];
@@ -162,6 +941,15 @@ namespace HSDetection
 
     void Detection::noscaleCast(IntVolt *trace, const FloatRaw *input)
     {
+        if (masked)
+        {
+            for (IntChannel i = 0; i < alignedChannels * channelAlign; i++)
+            {
+                trace[i] = input[inputChannels[i]];
+            }
+            return;
+        }
+
         for (IntChannel i = 0; i < alignedChannels * channelAlign; i++)
         {
             trace[i] = input[i];
@@ -177,42 +965,61 @@ namespace HSDetection
 
     void Detection::commonAverage(IntVolt *ref, const IntVolt *trace)
     {
-        IntCalc sum = accumulate(trace, trace + numChannels, (IntCalc)0,
-                                 [](IntCalc sum, IntVolt data)
-                                 { return sum + data; });
+        VoltCalc sum = accumulate(trace, trace + numChannels, (VoltCalc)0,
+                                  [](VoltCalc sum, IntVolt data)
+                                  { return sum + data; });
         *ref = sum / numChannels;
     }
 
-    void Detection::estimateAndDetect(IntFrame chunkStart, IntFrame chunkLen)
+    void Detection::estimateAndDetect(IntFrame chunkStart, IntFrame chunkLen, int part)
     {
-        int numThreads = omp_get_num_threads();
-        int threadNum = omp_get_thread_num();
-        // each thread have ceil(alignedChannels / numThreads), last has fewer
-        IntChannel thChannels = (alignedChannels + numThreads - 1) / numThreads;
-        IntChannel thAlignedStart = threadNum * thChannels;
-        IntChannel thAlignedEnd = (threadNum + 1) * thChannels;
-        thAlignedEnd = min(thAlignedEnd, alignedChannels);
-        IntChannel thActualEnd = min(thAlignedEnd * channelAlign, numChannels);
+        // partition only changes between steps, and never if NUMA aware
+        IntChannel thChannelStart = threadChannelSpan[part];
+        IntChannel thAlignedEnd = threadChannelSpan[part + 1];
+        IntChannel thActualEnd = min(thAlignedEnd, numChannels);
 
         for (IntFrame t = chunkStart; t < chunkStart + chunkLen; t++)
         {
+            if (artifactChannels > 0 && artifactFlag(t, 0))
+            {
+                blankFrame(t, thChannelStart, thAlignedEnd, thActualEnd);
+                continue;
+            }
+
             estimation(runningBaseline[t], runningDeviation[t],
                        trace[t], commonRef[t],
                        runningBaseline[t - 1], runningDeviation[t - 1],
-                       thAlignedStart, thAlignedEnd);
+                       thChannelStart, thAlignedEnd);
 
-            detection(trace[t], commonRef[t],
-                      runningBaseline[t], runningDeviation[t],
-                      thAlignedStart * channelAlign, thActualEnd, t);
+            for (int config = 0; config < numConfigs; config++) // shared cast and estimation, once per frame
+            {
+                detection(trace[t], commonRef[t],
+                          runningBaseline[t], runningDeviation[t],
+                          thChannelStart, thActualEnd, t, part, config);
+            }
+        }
+    }
+
+    void Detection::blankFrame(IntFrame t, IntChannel channelStart, IntChannel alignedEnd, IntChannel actualEnd)
+    {
+        // estimation held over the artifact, and spikes in progress dropped as they would end in it
+        copy(runningBaseline[t - 1] + channelStart, runningBaseline[t - 1] + alignedEnd,
+             runningBaseline[t] + channelStart);
+        copy(runningDeviation[t - 1] + channelStart, runningDeviation[t - 1] + alignedEnd,
+             runningDeviation[t] + channelStart);
+        for (int config = 0; config < numConfigs; config++)
+        {
+            IntFrame *spikeTime = this->spikeTime + (IntCalc)config * numChannels;
+            fill(spikeTime + channelStart, spikeTime + max(actualEnd, channelStart), (IntFrame)-1);
         }
     }
 
     void Detection::estimation(IntVolt *baselines, IntVolt *deviations,
                                const IntVolt *trace, const IntVolt *ref,
                                const IntVolt *basePrev, const IntVolt *devPrev,
-                               IntChannel alignedStart, IntChannel alignedEnd)
+                               IntChannel channelStart, IntChannel channelEnd)
     {
-        for (IntChannel i = alignedStart * channelAlign; i < alignedEnd * channelAlign; i++)
+        for (IntChannel i = channelStart; i < channelEnd; i++)
         {
             IntVolt volt = trace[i] - *ref - basePrev[i];
 
@@ -231,22 +1038,33 @@ namespace HSDetection
 
     void Detection::detection(const IntVolt *trace, const IntVolt *ref,
                               const IntVolt *baselines, const IntVolt *deviations,
-                              IntChannel channelStart, IntChannel channelEnd, IntFrame t)
+                              IntChannel channelStart, IntChannel channelEnd, IntFrame t, int part, int config)
     {
+        // state and thresholds of this config, under the same names as a single pass
+        IntFrame *spikeTime = this->spikeTime + (IntCalc)config * numChannels;
+        IntVolt *spikeAmp = this->spikeAmp + (IntCalc)config * numChannels;
+        VoltCalc *spikeArea = this->spikeArea + (IntCalc)config * numChannels;
+        bool *hasAHP = this->hasAHP + (IntCalc)config * numChannels;
+        IntCalc threshold = this->threshold[config];
+        IntCalc minAvgAmp = this->minAvgAmp[config];
+        IntCalc maxAHPAmp = this->maxAHPAmp[config];
+        SpikeQueue *pQueue = queues[config];
+
         for (IntChannel i = channelStart; i < channelEnd; i++)
         {
             IntVolt volt = trace[i] - *ref - baselines[i]; // calc against updated baselines
             IntVolt dev = deviations[i];
 
-            IntCalc voltThr = volt * thrQuant;
-            IntCalc thr = threshold * dev;
-            IntCalc minAvg = minAvgAmp * dev;
-            IntCalc maxAHP = maxAHPAmp * dev;
+            VoltCalc voltThr = volt * thrQuant;
+            VoltCalc thr = threshold * dev;
+            VoltCalc minAvg = minAvgAmp * dev;
+            VoltCalc maxAHP = maxAHPAmp * dev;
 
             if (spikeTime[i] < 0) // not in spike
             {
                 if (voltThr > thr) // threshold crossing
                 {
+                    channelCrossings[i]++;
                     spikeTime[i] = 0;
                     spikeAmp[i] = volt;
                     spikeArea[i] = voltThr;
@@ -292,7 +1110,7 @@ namespace HSDetection
             if (spikeArea[i] > minAvg * ampAvgDur && // reach min area
                 (hasAHP[i] || voltThr < maxAHP))     // AHP exist
             {
-                pQueue->addSpike(Spike(t - spikeDur, i, spikeAmp[i]));
+                pQueue->addSpike(Spike(t - spikeDur, i, spikeAmp[i]), part);
             }
 
             spikeTime[i] = -1; // reset counter even if not spike
@@ -1,8 +1,12 @@
 #ifndef DETECTION_H
 #define DETECTION_H
 
+#include <atomic>
 #include <string>
+#include <vector>
 
+#include "Arena.h"
+#include "DetectionStats.h"
 #include "ProbeLayout.h"
 #include "TraceWrapper.h"
 #include "RollingArray.h"
@@ -10,10 +14,23 @@
 
 namespace HSDetection
 {
+    class TraceReader;
+    struct DetectionStages;
+
+    // thresholds and jitter of a detection pass, so that several can share cast and estimation
+    struct DetectionConfig
+    {
+        FloatRatio threshold;    // threshold to detect spikes, used as multiplier of deviation
+        FloatRatio minAvgAmp;    // threshold for average amplitude of peak, used as multiplier of deviation
+        FloatRatio maxAHPAmp;    // threshold for voltage level of AHP, used as multiplier of deviation
+        IntFrame temporalJitter; // temporal jitter of the time of peak in electrical signal
+    };
+
     class Detection
     {
     private:
-        friend SpikeQueue; // allow access to the whole param set
+        friend SpikeQueue;      // allow access to the whole param set
+        friend DetectionStages; // allow benchmarks and checks on single stages (tests/cpp_mode/DetectionStages.h)
 
         // constants
         static constexpr IntVolt initBase = 0;  // initial value of baseline
@@ -28,17 +45,50 @@ namespace HSDetection
 
         static constexpr IntChannel alignChannel(IntChannel x) { return (x + (channelAlign - 1)) / channelAlign; }
 
+        static constexpr IntChannel laneAlign = 32 / sizeof(IntVolt); // granularity of partition, half a cache line
+        static constexpr IntFrame balanceLen = 1 << 15;                // frames between rebalances of partition
+        static constexpr IntCalc crossingCost = 4; // cost of a frame in spike relative to a frame of estimation
+
+        // memory, the fixed-size buffers below in one mapping instead of separate allocations
+        Arena arena;      // rolling arrays, per-channel state, progress of threads, laid out by placeBuffers
+        Arena inputArena; // input buffer on its own, mapped on first use as most callers pass their own chunks
+
         // input data
-        TraceWrapper traceRaw;      // input trace
-        IntChannel numChannels;     // number of probe channels
-        IntChannel alignedChannels; // number of slices of aligned channels
-        IntFrame chunkSize;         // size of each chunk, only the last chunk can be of a different (smaller) size
-        IntFrame chunkLeftMargin;   // margin on the left of each chunk
+        TraceWrapper traceRaw;       // input trace
+        FloatRaw *inputBuffer;       // input owned for stepInput, in inputArena on first use, nullptr before
+        IntChannel numInputChannels; // number of channels in each input frame, including masked ones
+        IntChannel numChannels;      // number of probe channels in use, compacted in all the buffers below
+        IntChannel alignedChannels;  // number of slices of aligned channels
+        IntChannel *inputChannels;   // input channel of each channel in use, padded to aligned, in arena
+        bool masked;                 // whether some input channels are left out, so that cast gathers
+        IntFrame chunkSize;          // max size of each chunk, chunks can be of different (smaller) sizes
+        IntFrame chunkLeftMargin;    // margin on the left of each chunk passed to step, not read
+        IntFrame historyLen;         // frames before each chunk kept in rolling arrays
+
+        // parallelization
+        int numThreads;                          // team size, fixed at construction
+        bool numaAware;                          // whether to bind threads and first-touch buffers by owner
+        bool rebalance;                          // whether the partition follows the cost, not if NUMA aware
+        std::vector<IntChannel> threadChannelSpan; // partition by lanes, part i owns channels [span[i], span[i+1])
+        IntFrame *channelCrossings;                // threshold crossings since last rebalance, cost of channels, in arena
+        IntFrame balanceFrames;                    // frames since last rebalance
+
+        // handoff from cast to estimation by blocks of frames, instead of barrier
+        struct alignas(64) CastProgress // aligned to avoid false sharing between threads
+        {
+            std::atomic<IntFrame> numBlocks; // blocks of which this thread has cast its share in current chunk
+        };
+
+        static constexpr IntFrame castBlockLen = 64; // frames cast by the team before handoff, split by frames
+        static constexpr int spinLimit = 1024;      // spins before yielding when waiting for handoff
+        static constexpr IntFrame minParallelLen = castBlockLen; // shorter steps run on calling thread
+
+        CastProgress *castProgress; // progress of each thread, in arena
 
         // rescaling
         bool rescale;       // whether to scale the input
-        FloatRaw *scale;    // scale for rescaling
-        FloatRaw *offset;   // offset for rescaling
+        FloatRaw *scale;    // scale for rescaling, in arena
+        FloatRaw *offset;   // offset for rescaling, in arena
         RollingArray trace; // rescaled and quantized trace to be used
 
         // common reference
@@ -50,27 +100,40 @@ namespace HSDetection
         RollingArray runningBaseline;  // running estimation of baseline (33 percentile)
         RollingArray runningDeviation; // running estimation of deviation from baseline
 
-        // detection
+        // artifact blanking, frames crossing threshold on many channels at once (e.g. stimulation, motion)
+        IntChannel artifactChannels;     // min channels crossing in one frame to blank it, 0 if not detected
+        IntVolt *artifactLevel;          // crossing level of each channel for the cast, set before each step, in arena
+        RollingArray artifactFlag;       // whether each frame is blanked, marked in cast and read in estimation
+        std::vector<IntFrame> artifacts; // [start, end) of each blanked interval closed so far, flattened
+        IntFrame artifactStart;          // start of the interval still open at the end of the last step, -1 if none
+
+        // detection, one pass for each config on the same estimation, the main one first and then the sweep
+        std::vector<DetectionConfig> configs; // thresholds as given, and temporal jitter used by the queues
+        int numConfigs;                       // number of detection passes, at least the main one
+
+        // state of each config in turn, numChannels for each, in arena
         IntFrame *spikeTime; // counter for time since spike peak
         IntVolt *spikeAmp;   // spike peak amplitude
-        IntCalc *spikeArea;  // area under spike used for average amplitude, actually integral*fps
+        VoltCalc *spikeArea; // area under spike used for average amplitude, actually integral*fps
         bool *hasAHP;        // flag for AHP existence
 
-        IntFrame spikeDur;  // duration of a spike since peak
-        IntFrame ampAvgDur; // duration to average amplitude
-        IntCalc threshold;  // threshold to detect spikes, used as multiplier of deviation
-        IntCalc minAvgAmp;  // threshold for average amplitude of peak, used as multiplier of deviation
-        IntCalc maxAHPAmp;  // threshold for voltage level of AHP, used as multiplier of deviation
+        IntFrame spikeDur;              // duration of a spike since peak
+        IntFrame ampAvgDur;             // duration to average amplitude
+        std::vector<IntCalc> threshold; // threshold to detect spikes of each config, quantized by thrQuant
+        std::vector<IntCalc> minAvgAmp; // threshold for average amplitude of peak of each config, quantized
+        std::vector<IntCalc> maxAHPAmp; // threshold for voltage level of AHP of each config, quantized
 
         // queue processing
-        SpikeQueue *pQueue; // spike queue, must be a pointer to be new-ed later
+        std::vector<SpikeQueue *> queues; // spike queue of each config, created and released here
 
         ProbeLayout probeLayout; // geometry for probe layout
 
-        std::vector<Spike> result; // detection result, use vector to expand as needed
+        std::vector<std::vector<Spike>> results; // detection result of each config, sized once for the queues
+        double stepLatency;                      // wall time in seconds of the last step, from input to emission
+        IntFrame nextFrame;                      // end of the last step, where a saved state resumes
+        DetectionStats stats;                    // counters of stages (of all configs), only updated if collectStats
 
-        IntFrame temporalJitter; // temporal jitter of the time of peak in electrical signal
-        IntFrame riseDur;        // duration that a spike rises to peak
+        IntFrame riseDur; // duration that a spike rises to peak
 
         // decay filtering
         bool decayFilter;      // whether to use decay filtering instead of normal one
@@ -81,29 +144,44 @@ namespace HSDetection
 
         // save shape
         bool saveShape;       // whether to save spike shapes to file
-        std::string filename; // filename for saving
+        std::string filename; // filename for saving (of the main config)
         IntFrame cutoutStart; // the start of spike shape cutout
         IntFrame cutoutEnd;   // the end of cutout
+        bool compressShape;   // whether to write the compressed format with index instead of raw
+        bool neighborShape;   // whether to cut out on all neighbors of the peak channel instead of peak only
+
+        // spike table
+        std::string tableFilename; // columnar table of spikes (of the main config), empty if not written
 
     private:
+        void placeBuffers();
+        void firstTouch();
+        void balancePartition();
+        void stepChunk(FloatRaw *chunkBuffer, IntFrame chunkStart, IntFrame chunkLen);
+        void stepInParallel(IntFrame chunkStart, IntFrame chunkLen);
         inline void scaleCast(IntVolt *trace, const FloatRaw *input);
         inline void noscaleCast(IntVolt *trace, const FloatRaw *input);
         inline void commonMedian(IntVolt *ref, const IntVolt *trace,
                                  IntVolt *buffer, IntChannel mid);
         inline void commonAverage(IntVolt *ref, const IntVolt *trace);
         void scaleAndAverage(IntFrame chunkStart, IntFrame chunkLen);
-        void castAndCommonref(IntFrame chunkStart, IntFrame chunkLen);
+        void castAndCommonref(IntFrame chunkStart, IntFrame chunkLen, IntVolt *medianBuffer);
+        void setArtifactLevel(IntFrame chunkStart);
+        void markArtifacts(IntFrame chunkStart, IntFrame chunkLen);
+        void collectArtifacts(IntFrame chunkStart, IntFrame chunkLen);
+        inline void waitCast(int teamSize, IntFrame numBlocks) const; // until all in team have cast their shares
         inline void estimation(IntVolt *baselines, IntVolt *deviations,
                                const IntVolt *trace, const IntVolt *ref,
                                const IntVolt *basePrev, const IntVolt *devPrev,
-                               IntChannel alignedStart, IntChannel alignedEnd);
+                               IntChannel channelStart, IntChannel channelEnd);
         inline void detection(const IntVolt *trace, const IntVolt *ref,
                               const IntVolt *baselines, const IntVolt *deviations,
-                              IntChannel channelStart, IntChannel channelEnd, IntFrame t);
-        void estimateAndDetect(IntFrame chunkStart, IntFrame chunkLen);
+                              IntChannel channelStart, IntChannel channelEnd, IntFrame t, int part, int config);
+        inline void blankFrame(IntFrame t, IntChannel channelStart, IntChannel alignedEnd, IntChannel actualEnd);
+        void estimateAndDetect(IntFrame chunkStart, IntFrame chunkLen, int part);
 
     public:
-        Detection(IntChannel numChannels, IntFrame chunkSize, IntFrame chunkLeftMargin,
+        Detection(IntChannel numInputChannels, IntFrame chunkSize, IntFrame chunkLeftMargin, bool numaAware,
                   bool rescale, const FloatRaw *scale, const FloatRaw *offset,
                   bool medianReference, bool averageReference,
                   IntFrame spikeDur, IntFrame ampAvgDur,
@@ -111,7 +189,12 @@ namespace HSDetection
                   const FloatGeom *channelPositions, FloatGeom neighborRadius, FloatGeom innerRadius,
                   IntFrame temporalJitter, IntFrame riseDur,
                   bool decayFiltering, FloatRatio decayRatio, bool localize,
-                  bool saveShape, std::string filename, IntFrame cutoutStart, IntFrame cutoutEnd);
+                  bool saveShape, std::string filename, IntFrame cutoutStart, IntFrame cutoutEnd,
+                  bool compressShape, bool neighborShape,
+                  const bool *channelMask /*nullptr if all in use*/,
+                  const std::vector<DetectionConfig> &sweepConfigs /*empty if only the main config*/,
+                  const std::string &tableFilename /*empty if not written*/,
+                  FloatRatio artifactFraction /*0 if artifacts not blanked*/);
         ~Detection();
 
         // copy constructor deleted to protect internals
@@ -120,8 +203,42 @@ namespace HSDetection
         Detection &operator=(const Detection &) = delete;
 
         void step(FloatRaw *traceBuffer, IntFrame chunkStart, IntFrame chunkLen);
+        FloatRaw *getInputBuffer();
+        void stepInput(IntFrame chunkStart, IntFrame chunkLen);
+        void stepFrom(TraceReader &reader, IntFrame chunkStart, IntFrame chunkLen);
         IntResult finish();
-        const Spike *getResult() const;
+        const Spike *getResult(int config = 0) const;
+        IntResult getNumResult(int config = 0) const;
+        int getNumConfigs() const;
+        // drop the spikes emitted so far (of all configs) from memory, e.g. once they are in the table
+        void discardResult();
+        // [start, end) of each interval blanked as artifact, flattened, the open one closed by finish
+        const IntFrame *getArtifacts() const;
+        IntResult getNumArtifacts() const;
+        double getStepLatency() const;
+        const DetectionStats &getStats() const;
+        IntChannel getShapeChannels() const;
+        // bytes mapped for the buffers (including the input buffer if used), and the pages backing them
+        IntCalc getFootprint() const;
+        const char *getPageKind() const;
+
+        // frames kept before each chunk in the rolling arrays, the same as in a Detection of these params,
+        // for callers sizing the chunks before construction
+        static IntFrame getHistoryLen(IntFrame spikeDur, IntFrame riseDur, IntFrame temporalJitter,
+                                      IntFrame cutoutStart, IntFrame cutoutEnd,
+                                      const std::vector<DetectionConfig> &sweepConfigs);
+
+        // shapes of sweep config k (from 1) beside the main file, as name.sweep<k>.ext
+        static std::string getSweepFilename(const std::string &filename, int config);
+
+        // seed the running estimation at its fixed point on given frames (e.g. the first ones or calibration
+        // chunks, in any order), instead of converging from initBase and initDev, only before the first step
+        void initEstimation(const FloatRaw *traceBuffer, IntFrame numFrames);
+
+        // snapshot at a chunk boundary (between steps), loaded into a new Detection of the same params
+        void saveState(const std::string &filename);
+        void loadState(const std::string &filename);
+        IntFrame getNextFrame() const;
 
     }; // class Detection
 
@@ -1,9 +1,14 @@
 # distutils: language=c++
 # cython: language_level=3
 
-from libc.stdint cimport int16_t, int32_t
+from libc.stdint cimport int32_t, int64_t
 from libcpp cimport bool
 from libcpp.string cimport string
+from libcpp.vector cimport vector
+
+cdef extern from "Types.h" namespace "HSDetection":
+    ctypedef double IntVolt  # int16 by default, or int32/float32 by precision mode, all exact in double
+    const char *voltDtype
 
 cdef extern from "Point.h" namespace "HSDetection":
     cdef cppclass Point:
@@ -14,14 +19,66 @@ cdef extern from "Spike.h" namespace "HSDetection":
     cdef cppclass Spike:
         int32_t frame
         int32_t channel
-        int16_t amplitude
+        IntVolt amplitude
         Point position
 
+cdef extern from "DetectionStats.h" namespace "HSDetection":
+    const bool collectStats
+
+    cdef cppclass ThreadStats:
+        double castTime
+        double estimateTime
+        double waitTime
+
+    cdef cppclass DetectionStats:
+        int64_t numSteps
+        int64_t numFrames
+        double stepTime
+        vector[ThreadStats] threads
+        double queueTime
+        int64_t numDetected
+        int64_t numEmitted
+        int64_t peakQueueLen
+        double finderTime
+        double filterTime
+        double localizeTime
+        double shapeTime
+        int64_t shapeBytes
+        int64_t numBlanked
+
+cdef extern from "TraceReader/TraceReader.h" namespace "HSDetection":
+    cdef cppclass TraceReader:
+        int32_t getNumFrames()
+        int32_t getNumChannels()
+
+cdef extern from "TraceReader/BinaryReader.h" namespace "HSDetection":
+    cdef cppclass BinaryReader(TraceReader):
+        BinaryReader(string filename, int32_t numChannels, string dtype, int64_t offset) except +
+
+cdef extern from "TraceReader/MdaReader.h" namespace "HSDetection":
+    cdef cppclass MdaReader(TraceReader):
+        MdaReader(string filename) except +
+
+cdef extern from "SpikeProcessor/ShapeReader.h" namespace "HSDetection":
+    cdef cppclass ShapeReader:
+        ShapeReader(string filename) except +
+        void read(int64_t spikeStart, int64_t numSpikes, IntVolt *buffer) except +
+        int64_t getNumSpikes()
+        int32_t getCutoutLen()
+        int32_t getNumChannels()
+
 cdef extern from "Detection.h" namespace "HSDetection":
+    cdef cppclass DetectionConfig:
+        float threshold
+        float minAvgAmp
+        float maxAHPAmp
+        int32_t temporalJitter
+
     cdef cppclass Detection:
         Detection(int32_t numChannels,
                   int32_t chunkSize,
                   int32_t chunkLeftMargin,
+                  bool numaAware,
                   bool rescale,
                   const float *scale,
                   const float *offset,
@@ -43,7 +100,34 @@ cdef extern from "Detection.h" namespace "HSDetection":
                   bool saveShape,
                   string filename,
                   int32_t cutoutStart,
-                  int32_t cutoutEnd) except +
+                  int32_t cutoutEnd,
+                  bool compressShape,
+                  bool neighborShape,
+                  const bool *channelMask,
+                  const vector[DetectionConfig] &sweepConfigs,
+                  string tableFilename,
+                  float artifactFraction) except +
         void step(float *traceBuffer, int32_t chunkStart, int32_t chunkLen) except +
+        float *getInputBuffer() except +
+        void stepInput(int32_t chunkStart, int32_t chunkLen) except +
+        void stepFrom(TraceReader &reader, int32_t chunkStart, int32_t chunkLen) except +
         int32_t finish() except +
-        const Spike *getResult() except +
+        const Spike *getResult(int config) except +
+        int32_t getNumResult(int config) except +
+        int getNumConfigs() except +
+        void discardResult() except +
+        const int32_t *getArtifacts() except +
+        int32_t getNumArtifacts() except +
+        double getStepLatency() except +
+        const DetectionStats &getStats() except +
+        int32_t getShapeChannels() except +
+        int64_t getFootprint() except +
+        @staticmethod
+        int32_t getHistoryLen(int32_t spikeDur, int32_t riseDur, int32_t temporalJitter,
+                              int32_t cutoutStart, int32_t cutoutEnd,
+                              const vector[DetectionConfig] &sweepConfigs) except +
+        const char *getPageKind() except +
+        void initEstimation(const float *traceBuffer, int32_t numFrames) except +
+        void saveState(string filename) except +
+        void loadState(string filename) except +
+        int32_t getNextFrame() except +
@@ -0,0 +1,54 @@
+#ifndef DETECTIONSTATS_H
+#define DETECTIONSTATS_H
+
+#include <vector>
+
+#include <omp.h>
+
+#include "Types.h"
+
+namespace HSDetection
+{
+#ifdef HSDETECTION_STATS
+    constexpr bool collectStats = true; // counters compiled in by -DHSDETECTION_STATS
+#else
+    constexpr bool collectStats = false; // counters compiled out, all stay zero
+#endif
+
+    // wall time for the counters, only called in branches of if constexpr (collectStats)
+    inline double statsClock() { return omp_get_wtime(); }
+
+    // per-thread counters in the parallel region, aligned to avoid false sharing
+    struct alignas(64) ThreadStats
+    {
+        double castTime = 0;     // cast and common reference on the share of each block cast by this thread
+        double estimateTime = 0; // estimation and detection on the parts owned by this thread
+        double waitTime = 0;     // waiting for the shares cast by other threads
+    };
+
+    // counters summed over all steps of a Detection, times in seconds
+    struct DetectionStats
+    {
+        IntCalc numSteps = 0;  // steps of any length
+        IntCalc numFrames = 0; // frames in all steps
+        double stepTime = 0;   // whole steps, from input to emission
+
+        std::vector<ThreadStats> threads; // one for each thread in the team
+
+        double queueTime = 0;     // merge of thread buffers and processing in queue
+        IntCalc numDetected = 0;  // spikes detected and pushed into queue
+        IntCalc numEmitted = 0;   // spikes through all processors into result
+        IntCalc peakQueueLen = 0; // max number of spikes waiting in queue
+
+        double finderTime = 0;   // by each processor, over numEmitted spikes
+        double filterTime = 0;   // normal or decay filtering
+        double localizeTime = 0; // zero if not localized
+        double shapeTime = 0;    // zero if shape not saved
+
+        IntCalc shapeBytes = 0; // bytes of shapes cut out, before compression if compressed
+        IntCalc numBlanked = 0; // frames blanked as artifacts
+    };
+
+} // namespace HSDetection
+
+#endif
@@ -42,4 +42,14 @@ namespace HSDetection
 
     ProbeLayout::~ProbeLayout() {}
 
+    IntChannel ProbeLayout::getMaxNeighbors() const
+    {
+        size_t maxNeighbors = 0;
+        for (const vector<IntChannel> &neighbors : neighborList)
+        {
+            maxNeighbors = max(maxNeighbors, neighbors.size());
+        }
+        return maxNeighbors;
+    }
+
 } // namespace HSDetection
@@ -29,6 +29,9 @@ namespace HSDetection
         // copy assignment deleted to avoid copy of containers
         ProbeLayout &operator=(const ProbeLayout &) = delete;
 
+        IntChannel getNumChannels() const { return positions.size(); }
+        IntChannel getMaxNeighbors() const; // size of the largest neighborhood, including self
+
         const Point &getChannelPosition(IntChannel channel) const { return positions[channel]; }
 
         FloatGeom getChannelDistance(IntChannel channel1, IntChannel channel2) const { return distances[channel1][channel2]; }
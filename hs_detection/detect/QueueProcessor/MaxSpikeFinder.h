@@ -1,6 +1,9 @@
 #ifndef MAXSPIKEFINDER_H
 #define MAXSPIKEFINDER_H
 
+#include <algorithm>
+#include <utility>
+
 #include "QueueProcessor.h"
 #include "../ProbeLayout.h"
 
@@ -17,9 +20,27 @@ namespace HSDetection
         MaxSpikeFinder(const ProbeLayout *pLayout, IntFrame temporalJitter);
         ~MaxSpikeFinder();
 
-        void operator()(SpikeQueue *pQueue);
+        inline void operator()(SpikeQueue *pQueue);
     };
 
+    // defined in header to be inlined into the specialized pipeline
+    void MaxSpikeFinder::operator()(SpikeQueue *pQueue)
+    {
+        IntFrame frameBound = pQueue->begin()->frame + temporalJitter;
+        IntChannel centerChannel = pQueue->begin()->channel;
+
+        SpikeQueue::iterator itMax = std::max_element(
+            pQueue->begin(), pQueue->end(),
+            [this, frameBound, centerChannel](const Spike &lhs, const Spike &rhs)
+            { return rhs.frame <= frameBound &&
+                     pLayout->areNeighbors(rhs.channel, centerChannel) &&
+                     lhs.amplitude <= rhs.amplitude; });
+        // using amp <=, so it's the latest max spike in spatial-temporal neighborhood
+
+        pQueue->push_front(std::move(*itMax));
+        pQueue->erase(itMax);
+    }
+
 } // namespace HSDetection
 
 #endif
@@ -5,18 +5,19 @@
 
 namespace HSDetection
 {
+    // base of processors on the whole queue, no virtual dispatch
+    // derived should provide inline void operator()(SpikeQueue *pQueue),
+    // and it is called statically in the pipeline specialized in SpikeQueue
     class QueueProcessor
     {
     public:
         QueueProcessor() {}
-        virtual ~QueueProcessor() {}
+        ~QueueProcessor() {}
 
         // copy constructor deleted to protect possible internals
         QueueProcessor(const QueueProcessor &) = delete;
         // copy assignment deleted to protect possible internals
         QueueProcessor &operator=(const QueueProcessor &) = delete;
-
-        virtual void operator()(SpikeQueue *pQueue) = 0;
     };
 
 } // namespace HSDetection
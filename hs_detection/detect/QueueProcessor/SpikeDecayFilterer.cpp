@@ -1,6 +1,4 @@
-#include <set>
 #include <algorithm>
-#include <utility>
 
 #include "SpikeDecayFilterer.h"
 
@@ -13,37 +11,6 @@ namespace HSDetection
 
     SpikeDecayFilterer::~SpikeDecayFilterer() {}
 
-    void SpikeDecayFilterer::operator()(SpikeQueue *pQueue)
-    {
-        Spike maxSpike = move(*pQueue->begin());
-        pQueue->erase(pQueue->begin());
-
-        IntFrame frameBound = maxSpike.frame + temporalJitter;
-        IntChannel maxChannel = maxSpike.channel;
-        IntVolt maxAmp = maxSpike.amplitude;
-
-        { // filter outer neighbors
-            auto cmp = [](const Spike &lhs, const Spike &rhs)
-            { return lhs.frame < rhs.frame || (lhs.frame == rhs.frame && lhs.channel < rhs.channel); };
-            set<Spike, decltype(cmp)> outerSpikes(cmp); // log-time find with any insert order
-
-            copy_if(pQueue->begin(), pQueue->end(), inserter(outerSpikes, outerSpikes.begin()),
-                    [this, pQueue, frameBound, maxChannel](const Spike &spike)
-                    { return spike.frame <= frameBound &&
-                             pLayout->areOuterNeighbors(spike.channel, maxChannel) &&
-                             shouldFilterOuter(pQueue, spike); });
-
-            pQueue->remove_if([&outerSpikes](const Spike &spike)
-                              { return outerSpikes.find(spike) != outerSpikes.end(); });
-        }
-
-        pQueue->remove_if([this, frameBound, maxChannel, maxAmp](const Spike &spike)
-                          { return spike.frame <= frameBound &&
-                                   pLayout->areInnerNeighbors(spike.channel, maxChannel) &&
-                                   spike.amplitude <= maxAmp; });
-        pQueue->push_front(move(maxSpike));
-    }
-
     bool SpikeDecayFilterer::shouldFilterOuter(SpikeQueue *pQueue, const Spike &outerSpike) const
     {
         IntChannel maxChannel = pQueue->begin()->channel;
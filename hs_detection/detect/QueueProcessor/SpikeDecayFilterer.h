@@ -1,6 +1,11 @@
 #ifndef SPIKEDECAYFILTERER_H
 #define SPIKEDECAYFILTERER_H
 
+#include <set>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
 #include "QueueProcessor.h"
 #include "../ProbeLayout.h"
 
@@ -20,9 +25,41 @@ namespace HSDetection
         SpikeDecayFilterer(const ProbeLayout *pLayout, IntFrame temporalJitter, FloatRatio decayRatio);
         ~SpikeDecayFilterer();
 
-        void operator()(SpikeQueue *pQueue);
+        inline void operator()(SpikeQueue *pQueue);
     };
 
+    // defined in header to be inlined into the specialized pipeline
+    void SpikeDecayFilterer::operator()(SpikeQueue *pQueue)
+    {
+        Spike maxSpike = std::move(*pQueue->begin());
+        pQueue->erase(pQueue->begin());
+
+        IntFrame frameBound = maxSpike.frame + temporalJitter;
+        IntChannel maxChannel = maxSpike.channel;
+        IntVolt maxAmp = maxSpike.amplitude;
+
+        { // filter outer neighbors
+            auto cmp = [](const Spike &lhs, const Spike &rhs)
+            { return lhs.frame < rhs.frame || (lhs.frame == rhs.frame && lhs.channel < rhs.channel); };
+            std::set<Spike, decltype(cmp)> outerSpikes(cmp); // log-time find with any insert order
+
+            std::copy_if(pQueue->begin(), pQueue->end(), std::inserter(outerSpikes, outerSpikes.begin()),
+                         [this, pQueue, frameBound, maxChannel](const Spike &spike)
+                         { return spike.frame <= frameBound &&
+                                  pLayout->areOuterNeighbors(spike.channel, maxChannel) &&
+                                  shouldFilterOuter(pQueue, spike); });
+
+            pQueue->remove_if([&outerSpikes](const Spike &spike)
+                              { return outerSpikes.find(spike) != outerSpikes.end(); });
+        }
+
+        pQueue->remove_if([this, frameBound, maxChannel, maxAmp](const Spike &spike)
+                          { return spike.frame <= frameBound &&
+                                   pLayout->areInnerNeighbors(spike.channel, maxChannel) &&
+                                   spike.amplitude <= maxAmp; });
+        pQueue->push_front(std::move(maxSpike));
+    }
+
 } // namespace HSDetection
 
 #endif
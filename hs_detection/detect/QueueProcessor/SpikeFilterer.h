@@ -1,6 +1,8 @@
 #ifndef SPIKEFILTERER_H
 #define SPIKEFILTERER_H
 
+#include <utility>
+
 #include "QueueProcessor.h"
 #include "../ProbeLayout.h"
 
@@ -17,9 +19,26 @@ namespace HSDetection
         SpikeFilterer(const ProbeLayout *pLayout, IntFrame temporalJitter);
         ~SpikeFilterer();
 
-        void operator()(SpikeQueue *pQueue);
+        inline void operator()(SpikeQueue *pQueue);
     };
 
+    // defined in header to be inlined into the specialized pipeline
+    void SpikeFilterer::operator()(SpikeQueue *pQueue)
+    {
+        Spike maxSpike = std::move(*pQueue->begin());
+        pQueue->erase(pQueue->begin());
+
+        IntFrame frameBound = maxSpike.frame + temporalJitter;
+        IntChannel maxChannel = maxSpike.channel;
+        IntVolt maxAmp = maxSpike.amplitude;
+
+        pQueue->remove_if([this, frameBound, maxChannel, maxAmp](const Spike &spike)
+                          { return spike.frame <= frameBound &&
+                                   pLayout->areNeighbors(spike.channel, maxChannel) &&
+                                   spike.amplitude <= maxAmp; });
+        pQueue->push_front(std::move(maxSpike));
+    }
+
 } // namespace HSDetection
 
 #endif
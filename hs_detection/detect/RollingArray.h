@@ -1,6 +1,10 @@
 #ifndef ROLLINGARRAY_H
 #define ROLLINGARRAY_H
 
+#include <algorithm>
+#include <cstdint>
+
+#include "Arena.h"
 #include "Types.h"
 
 namespace HSDetection
@@ -8,13 +12,11 @@ namespace HSDetection
     class RollingArray
     {
     private:
-        IntVolt *arrayBuffer; // created and released here
+        IntVolt *arrayBuffer; // placed in the arena of the owner, not released here
 
         IntFrame frameMask; // rolling length will be 2^n and mask is 2^n-1 for bit ops
         IntChannel numChannels;
 
-        static constexpr std::align_val_t memAlign = std::align_val_t(512); // align to 4K/8 to avoid 4K alias
-
         static constexpr IntFrame getMask(IntFrame x) // get minimum 0...01...1 >= x
         {
             x |= x >> 1;
@@ -28,17 +30,41 @@ namespace HSDetection
 
     public:
         RollingArray(IntFrame rollingLen, IntChannel numChannels)
-            : frameMask(getMask(rollingLen)), numChannels(numChannels)
-        {
-            arrayBuffer = new (memAlign) IntVolt[(IntCalc)(frameMask + 1) * numChannels];
-        }
-        ~RollingArray() { operator delete[](arrayBuffer, memAlign); }
+            : arrayBuffer(nullptr), frameMask(getMask(rollingLen)), numChannels(numChannels) {}
+        ~RollingArray() {}
 
         // copy constructor deleted to protect buffer
         RollingArray(const RollingArray &) = delete;
         // copy assignment deleted to protect buffer
         RollingArray &operator=(const RollingArray &) = delete;
 
+        // should be called in both layouts of the arena, before any access
+        void place(Arena &arena) { arrayBuffer = arena.allocate<IntVolt>((IntCalc)(frameMask + 1) * numChannels); }
+
+        // zero the pages of which the first element is in the channel range,
+        // so that when called by all threads on a partition of channels,
+        // each page is touched exactly once and placed whole on the NUMA node of the thread touching it;
+        // rows are frame-major, so a page only holds the channels of that thread if a row spans several pages
+        // (more than 2048 channels of int16), shorter rows have all parts on each page and just spread the pages
+        void firstTouch(IntChannel channelStart, IntChannel channelEnd)
+        {
+            constexpr IntCalc pageSize = 4096 / sizeof(IntVolt);
+            IntCalc bufferSize = (IntCalc)(frameMask + 1) * numChannels;
+            IntCalc pageEnd = ((-(uintptr_t)arrayBuffer) % 4096) / sizeof(IntVolt); // first page boundary
+            for (IntCalc pageStart = 0; pageStart < bufferSize; pageStart = pageEnd, pageEnd += pageSize)
+            {
+                pageEnd = (pageEnd == 0) ? pageSize : std::min(pageEnd, bufferSize);
+                IntChannel channel = pageStart % numChannels;
+                if (channelStart <= channel && channel < channelEnd)
+                {
+                    std::fill(arrayBuffer + pageStart, arrayBuffer + pageEnd, (IntVolt)0);
+                }
+            }
+        }
+
+        IntChannel getNumChannels() const { return numChannels; }
+        IntFrame getRollingLen() const { return frameMask + 1; }
+
         const IntVolt *operator[](IntFrame frame) const { return arrayBuffer + ((IntCalc)frame & frameMask) * numChannels; }
         IntVolt *operator[](IntFrame frame) { return arrayBuffer + ((IntCalc)frame & frameMask) * numChannels; }
 
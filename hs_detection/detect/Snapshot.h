@@ -0,0 +1,100 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "Spike.h"
+
+namespace HSDetection
+{
+    // binary snapshot of detection state, in the memory layout of this build,
+    // so only valid for the same build and the same params
+    namespace Snapshot
+    {
+        constexpr char magic[8] = {'H', 'S', 'S', 'T', 'A', 'T', 'E', '1'};
+
+        template <typename T>
+        inline void write(std::ostream &out, const T *data, IntCalc count)
+        {
+            out.write((const char *)data, count * sizeof(T));
+        }
+
+        template <typename T>
+        inline void read(std::istream &in, T *data, IntCalc count)
+        {
+            if (!in.read((char *)data, count * sizeof(T)))
+            {
+                throw std::runtime_error("Snapshot: truncated file");
+            }
+        }
+
+        template <typename T>
+        inline void write(std::ostream &out, const T &value) { write(out, &value, 1); }
+
+        template <typename T>
+        inline T read(std::istream &in)
+        {
+            T value;
+            read(in, &value, 1);
+            return value;
+        }
+
+        // by fields, Spike is not trivially copyable
+        inline void writeSpike(std::ostream &out, const Spike &spike)
+        {
+            write(out, spike.frame);
+            write(out, spike.channel);
+            write(out, spike.amplitude);
+            write(out, spike.position.x);
+            write(out, spike.position.y);
+        }
+
+        inline Spike readSpike(std::istream &in)
+        {
+            Spike spike(read<IntFrame>(in), 0, 0); // fields read in order of writeSpike
+            spike.channel = read<IntChannel>(in);
+            spike.amplitude = read<IntVolt>(in);
+            spike.position.x = read<FloatGeom>(in);
+            spike.position.y = read<FloatGeom>(in);
+            return spike;
+        }
+
+        // the value recorded must match the current, e.g. a param that sizes buffers
+        template <typename T>
+        inline void check(std::istream &in, const T &current, const char *what)
+        {
+            if (read<T>(in) != current)
+            {
+                throw std::runtime_error(std::string("Snapshot: different ") + what + " from the saved detection");
+            }
+        }
+
+        // output files of processors are opened without truncation, so that a resumed run continues them
+        inline void openKept(std::fstream &file, const std::string &filename)
+        {
+            file.open(filename, std::ios::binary | std::ios::in | std::ios::out);
+            if (!file.is_open()) // not existing yet
+            {
+                file.open(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+            }
+        }
+
+        // and dropped after the end of writing on close
+        inline void closeAt(std::fstream &file, const std::string &filename)
+        {
+            std::streamoff end = file.tellp();
+            file.close();
+            std::error_code error; // ignored, e.g. for devices
+            std::filesystem::resize_file(filename, end, error);
+        }
+
+    } // namespace Snapshot
+
+} // namespace HSDetection
+
+#endif
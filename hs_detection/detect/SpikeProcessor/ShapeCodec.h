@@ -0,0 +1,189 @@
+#ifndef SHAPECODEC_H
+#define SHAPECODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "../Types.h"
+
+namespace HSDetection
+{
+    // compressed shape file, written by SpikeShapeWriter and read by ShapeReader:
+    // header, blocks of up to blockSpikes shapes, index of block offsets, footer
+    // each channel of a shape is delta coded along frames, zigzag mapped, and bit-packed at the width of its max delta
+    // float samples are coded by their bits, lossless but less compressed
+    class ShapeCodec
+    {
+    public:
+        static constexpr char headerMagic[8] = {'H', 'S', 'S', 'H', 'A', 'P', 'E', '2'};
+        static constexpr char footerMagic[8] = {'H', 'S', 'I', 'N', 'D', 'E', 'X', '1'};
+        static constexpr uint32_t blockSpikes = 256; // shapes in a block, the unit of random access
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t cutoutLen;   // frames in each shape
+            uint32_t sampleBytes; // sizeof(IntVolt) of the writer
+            uint32_t isFloat;     // whether IntVolt is float
+            uint32_t blockSpikes; // shapes in each block except the last
+            uint32_t numChannels; // channels in each shape, frame-major, 0 if only peak channel (no channel axis)
+            uint32_t reserved;
+        };
+
+        struct BlockHeader
+        {
+            uint32_t numSpikes;    // shapes in this block
+            uint32_t payloadBytes; // bytes of packed shapes following
+        };
+
+        struct Footer
+        {
+            uint64_t numSpikes;   // shapes in the file
+            uint64_t indexOffset; // file offset of uint64 offsets of blocks
+            char magic[8];
+        };
+
+    private:
+        // integer of the same width for the bits of samples
+        typedef std::conditional_t<std::is_floating_point_v<IntVolt>, int32_t, IntVolt> IntBits;
+
+        static int64_t toBits(IntVolt sample)
+        {
+            IntBits bits;
+            std::memcpy(&bits, &sample, sizeof(IntBits));
+            return bits;
+        }
+
+        static IntVolt fromBits(int64_t value)
+        {
+            IntBits bits = (IntBits)value;
+            IntVolt sample;
+            std::memcpy(&sample, &bits, sizeof(IntBits));
+            return sample;
+        }
+
+        static uint64_t zigzag(int64_t x) { return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); }
+        static int64_t unzigzag(uint64_t x) { return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+        // one column of a shape, cutoutLen samples at stride apart:
+        // the first sample as a varint, one width byte, and the byte-aligned bits of the following deltas
+        static void encodeColumn(const IntVolt *column, IntCalc cutoutLen, IntCalc stride,
+                                 std::vector<uint8_t> &out, std::vector<uint64_t> &deltaBuffer)
+        {
+            int64_t prev = 0;
+            uint64_t maxDelta = 0;
+            for (IntCalc t = 0; t < cutoutLen; t++)
+            {
+                int64_t bits = toBits(column[t * stride]);
+                deltaBuffer[t] = zigzag(bits - prev);
+                maxDelta |= t == 0 ? 0 : deltaBuffer[t]; // first sample not counted in width
+                prev = bits;
+            }
+
+            for (uint64_t first = deltaBuffer[0]; true; first >>= 7)
+            {
+                if (first < 0x80)
+                {
+                    out.push_back(first);
+                    break;
+                }
+                out.push_back((first & 0x7F) | 0x80);
+            }
+
+            int width = 0; // at most 33 for deltas of int32 bits
+            while ((maxDelta >> width) != 0)
+            {
+                width++;
+            }
+            out.push_back(width);
+
+            uint64_t acc = 0; // at most 7 bits left and width bits added
+            int numBits = 0;
+            for (IntCalc t = 1; t < cutoutLen; t++)
+            {
+                acc |= deltaBuffer[t] << numBits;
+                numBits += width;
+                for (; numBits >= 8; numBits -= 8, acc >>= 8)
+                {
+                    out.push_back(acc & 0xFF);
+                }
+            }
+            if (numBits > 0)
+            {
+                out.push_back(acc & 0xFF);
+            }
+        }
+
+        static const uint8_t *decodeColumn(const uint8_t *data, IntCalc cutoutLen, IntCalc stride, IntVolt *column)
+        {
+            uint64_t first = 0;
+            for (int shift = 0; true; shift += 7)
+            {
+                uint8_t byte = *data++;
+                first |= (uint64_t)(byte & 0x7F) << shift;
+                if (byte < 0x80)
+                {
+                    break;
+                }
+            }
+            int64_t prev = unzigzag(first);
+            column[0] = fromBits(prev);
+
+            int width = *data++;
+            uint64_t mask = ((uint64_t)1 << width) - 1;
+
+            uint64_t acc = 0;
+            int numBits = 0;
+            for (IntCalc t = 1; t < cutoutLen; t++)
+            {
+                for (; numBits < width; numBits += 8)
+                {
+                    acc |= (uint64_t)*data++ << numBits;
+                }
+                prev += unzigzag(acc & mask);
+                column[t * stride] = fromBits(prev);
+                acc >>= width;
+                numBits -= width;
+            }
+            return data;
+        }
+
+    public:
+        // append the packed shapes of cutoutLen frames x numSlots channels (frame-major) to out,
+        // each channel as its own column along frames, so that deltas are never taken across channels
+        static void encode(const IntVolt *shapes, IntCalc numSpikes, IntCalc cutoutLen, IntCalc numSlots,
+                           std::vector<uint8_t> &out, std::vector<uint64_t> &deltaBuffer)
+        {
+            deltaBuffer.resize(cutoutLen);
+            for (IntCalc s = 0; s < numSpikes; s++)
+            {
+                const IntVolt *shape = shapes + s * cutoutLen * numSlots;
+                for (IntCalc slot = 0; slot < numSlots; slot++)
+                {
+                    encodeColumn(shape + slot, cutoutLen, numSlots, out, deltaBuffer);
+                }
+            }
+        }
+
+        // decode numSpikes shapes from the packed bytes, returns the bytes consumed
+        static IntCalc decode(const uint8_t *data, IntCalc numSpikes, IntCalc cutoutLen, IntCalc numSlots,
+                              IntVolt *shapes)
+        {
+            const uint8_t *start = data;
+            for (IntCalc s = 0; s < numSpikes; s++)
+            {
+                IntVolt *shape = shapes + s * cutoutLen * numSlots;
+                for (IntCalc slot = 0; slot < numSlots; slot++)
+                {
+                    data = decodeColumn(data, cutoutLen, numSlots, shape + slot);
+                }
+            }
+            return data - start;
+        }
+    };
+
+} // namespace HSDetection
+
+#endif
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "ShapeCodec.h"
+#include "ShapeReader.h"
+
+using namespace std;
+
+namespace HSDetection
+{
+    ShapeReader::ShapeReader(const string &filename)
+        : file(filename, ios::binary), numSpikes(0), cutoutLen(0), numChannels(0), shapeLen(0), blockSpikes(0),
+          blockOffsets(), cachedBlock(-1), blockShapes(), packed()
+    {
+        if (!file)
+        {
+            throw runtime_error("ShapeReader: cannot open " + filename);
+        }
+
+        ShapeCodec::Header header;
+        if (!file.read((char *)&header, sizeof(header)) ||
+            memcmp(header.magic, ShapeCodec::headerMagic, sizeof(header.magic)) != 0)
+        {
+            throw runtime_error("ShapeReader: not a compressed shape file " + filename);
+        }
+        if (header.sampleBytes != sizeof(IntVolt) || header.isFloat != is_floating_point_v<IntVolt>)
+        {
+            throw runtime_error(string("ShapeReader: file of another precision than ") + voltDtype + " " + filename);
+        }
+
+        ShapeCodec::Footer footer;
+        if (!file.seekg(-(streamoff)sizeof(footer), ios::end) ||
+            !file.read((char *)&footer, sizeof(footer)) ||
+            memcmp(footer.magic, ShapeCodec::footerMagic, sizeof(footer.magic)) != 0)
+        {
+            throw runtime_error("ShapeReader: missing index, file not closed properly " + filename);
+        }
+
+        numSpikes = footer.numSpikes;
+        cutoutLen = header.cutoutLen;
+        numChannels = header.numChannels;
+        shapeLen = (IntCalc)cutoutLen * max(numChannels, 1);
+        blockSpikes = header.blockSpikes;
+
+        blockOffsets.resize((numSpikes + blockSpikes - 1) / blockSpikes);
+        file.seekg(footer.indexOffset);
+        if (!file.read((char *)blockOffsets.data(), blockOffsets.size() * sizeof(uint64_t)))
+        {
+            throw runtime_error("ShapeReader: truncated index " + filename);
+        }
+    }
+
+    ShapeReader::~ShapeReader() { file.close(); }
+
+    void ShapeReader::loadBlock(IntCalc blockIndex)
+    {
+        ShapeCodec::BlockHeader blockHeader;
+        file.seekg(blockOffsets[blockIndex]);
+        file.read((char *)&blockHeader, sizeof(blockHeader));
+        packed.resize(blockHeader.payloadBytes);
+        if (!file.read((char *)packed.data(), packed.size()))
+        {
+            throw runtime_error("ShapeReader: truncated block");
+        }
+
+        blockShapes.resize((size_t)blockHeader.numSpikes * shapeLen);
+        ShapeCodec::decode(packed.data(), blockHeader.numSpikes, cutoutLen, max(numChannels, 1), blockShapes.data());
+        cachedBlock = blockIndex;
+    }
+
+    void ShapeReader::read(IntCalc spikeStart, IntCalc numSpikes, IntVolt *buffer)
+    {
+        if (spikeStart < 0 || numSpikes < 0 || spikeStart + numSpikes > this->numSpikes)
+        {
+            throw out_of_range("ShapeReader: spike index out of range");
+        }
+
+        for (IntCalc spike = spikeStart; spike < spikeStart + numSpikes;)
+        {
+            IntCalc blockIndex = spike / blockSpikes;
+            if (blockIndex != cachedBlock)
+            {
+                loadBlock(blockIndex);
+            }
+
+            IntCalc offset = spike - blockIndex * blockSpikes;
+            IntCalc count = min(blockSpikes - offset, spikeStart + numSpikes - spike);
+            copy_n(blockShapes.data() + offset * shapeLen, count * shapeLen,
+                   buffer + (spike - spikeStart) * shapeLen);
+            spike += count;
+        }
+    }
+
+} // namespace HSDetection
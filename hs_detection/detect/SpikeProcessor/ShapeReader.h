@@ -0,0 +1,52 @@
+#ifndef SHAPEREADER_H
+#define SHAPEREADER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../Types.h"
+
+namespace HSDetection
+{
+    // random access to the compressed shape file of SpikeShapeWriter, by spike index
+    class ShapeReader
+    {
+    private:
+        std::ifstream file;
+
+        IntCalc numSpikes;      // shapes in the file
+        IntFrame cutoutLen;     // frames in each shape
+        IntChannel numChannels; // channels in each shape, frame-major, 0 if only peak channel
+        IntCalc shapeLen;       // samples in each shape
+        IntCalc blockSpikes;    // shapes in each block except the last
+
+        std::vector<uint64_t> blockOffsets; // file offsets of blocks
+
+        IntCalc cachedBlock;              // index of the decoded block, -1 if none
+        std::vector<IntVolt> blockShapes; // shapes of the decoded block
+        std::vector<uint8_t> packed;      // payload of the block being decoded
+
+        void loadBlock(IntCalc blockIndex);
+
+    public:
+        ShapeReader(const std::string &filename);
+        ~ShapeReader();
+
+        // copy constructor deleted to protect internals
+        ShapeReader(const ShapeReader &) = delete;
+        // copy assignment deleted to protect internals
+        ShapeReader &operator=(const ShapeReader &) = delete;
+
+        // copy shapes [spikeStart, spikeStart+numSpikes) into buffer of numSpikes*cutoutLen*max(numChannels,1)
+        void read(IntCalc spikeStart, IntCalc numSpikes, IntVolt *buffer);
+
+        IntCalc getNumSpikes() const { return numSpikes; }
+        IntFrame getCutoutLen() const { return cutoutLen; }
+        IntChannel getNumChannels() const { return numChannels; }
+    };
+
+} // namespace HSDetection
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef SPIKELOCALIZER_H
 #define SPIKELOCALIZER_H
 
+#include <vector>
+
 #include "SpikeProcessor.h"
 #include "../ProbeLayout.h"
 #include "../RollingArray.h"
@@ -20,8 +22,8 @@ namespace HSDetection
 
         static constexpr FloatGeom eps = 1e-12;
 
-        IntCalc sumCutout(IntFrame frame, IntChannel channel) const;
-        IntCalc getMedian(std::vector<IntCalc> weights) const; // copy param to be modified inside
+        inline VoltCalc sumCutout(IntFrame frame, IntChannel channel) const;
+        VoltCalc getMedian(std::vector<VoltCalc> weights) const; // copy param to be modified inside
 
     public:
         SpikeLocalizer(const ProbeLayout *pLayout, const RollingArray *pTrace,
@@ -29,10 +31,54 @@ namespace HSDetection
                        IntFrame temporalJitter, IntFrame riseDur);
         ~SpikeLocalizer();
 
-        using SpikeProcessor::operator(); // allow call on iterator
-        void operator()(Spike *pSpike);
+        inline void operator()(Spike *pSpike);
     };
 
+    // defined in header to be inlined into the specialized pipeline
+    void SpikeLocalizer::operator()(Spike *pSpike)
+    {
+        const std::vector<IntChannel> &neighbors = pLayout->getInnerNeighbors(pSpike->channel);
+        int numNeighbors = neighbors.size();
+
+        std::vector<VoltCalc> weights(numNeighbors);
+        for (int i = 0; i < numNeighbors; i++)
+        {
+            weights[i] = sumCutout(pSpike->frame, neighbors[i]);
+        }
+
+        VoltCalc median = getMedian(weights);
+
+        Point sumPoint(0, 0);
+        FloatGeom sumWeight = 0;
+        for (int i = 0; i < numNeighbors; i++)
+        {
+            VoltCalc weight = weights[i] - median; // correction and threshold on median
+            if (weight >= 0)
+            {
+                sumPoint += (weight + eps) * pLayout->getChannelPosition(neighbors[i]);
+                sumWeight += weight + eps;
+            }
+        }
+
+        pSpike->position = sumPoint / sumWeight;
+    }
+
+    VoltCalc SpikeLocalizer::sumCutout(IntFrame frame, IntChannel channel) const
+    {
+        IntVolt baseline = (*pBaseline)[frame - riseDur][channel]; // baseline at the start of event
+
+        VoltCalc sum = 0;
+        for (IntFrame t = frame - temporalJitter; t <= frame + temporalJitter; t++)
+        {
+            IntVolt volt = (*pTrace)(t, channel) - baseline - (*pRef)(t, 0);
+            if (volt > 0)
+            {
+                sum += volt;
+            }
+        }
+        return sum;
+    }
+
 } // namespace HSDetection
 
 #endif
@@ -5,19 +5,19 @@
 
 namespace HSDetection
 {
+    // base of processors on the first spike of queue, no virtual dispatch
+    // derived should provide inline void operator()(Spike *pSpike),
+    // and it is called statically in the pipeline specialized in SpikeQueue
     class SpikeProcessor
     {
     public:
         SpikeProcessor() {}
-        virtual ~SpikeProcessor() {}
+        ~SpikeProcessor() {}
 
         // copy constructor deleted to protect possible internals
         SpikeProcessor(const SpikeProcessor &) = delete;
         // copy assignment deleted to protect possible internals
         SpikeProcessor &operator=(const SpikeProcessor &) = delete;
-
-        void operator()(SpikeQueue::iterator itSpike) { (*this)(&*itSpike); };
-        virtual void operator()(Spike *pSpike) = 0;
     };
 
 } // namespace HSDetection
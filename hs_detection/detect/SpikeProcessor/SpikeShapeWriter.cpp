@@ -1,30 +1,209 @@
+#include <filesystem>
+#include <stdexcept>
+
 #include "SpikeShapeWriter.h"
+#include "../Snapshot.h"
 
 using namespace std;
 
 namespace HSDetection
 {
     SpikeShapeWriter::SpikeShapeWriter(const string &filename, const RollingArray *pTrace,
-                                       IntFrame cutoutStart, IntFrame cutoutEnd)
-        : spikeFile(filename, ios::binary | ios::trunc),
-          buffer(new IntVolt[cutoutStart + 1 + cutoutEnd]), pTrace(pTrace),
-          cutoutStart(cutoutStart), cutoutLen(cutoutStart + 1 + cutoutEnd) {}
+                                       const ProbeLayout *pLayout, const IntChannel *inputChannels,
+                                       IntFrame cutoutStart, IntFrame cutoutEnd, bool compress)
+        : filename(filename), spikeFile(), buffer(nullptr), pTrace(pTrace), pLayout(pLayout),
+          cutoutStart(cutoutStart), cutoutLen(cutoutStart + 1 + cutoutEnd),
+          numSlots(pLayout == nullptr ? 1 : pLayout->getMaxNeighbors()), cutoutSize((IntCalc)cutoutLen * numSlots),
+          neighborRuns(), neighborTable(), channelFile(),
+          compress(compress), block(), pending(), blockOffsets(), numSpikes(0), numInFlight(0), closing(false),
+          pendingMutex(), pendingChanged(), compressor()
+    {
+        buffer = new IntVolt[cutoutSize];
+        Snapshot::openKept(spikeFile, filename);
+
+        if (pLayout != nullptr)
+        {
+            IntChannel numChannels = pLayout->getNumChannels();
+            neighborRuns.resize(numChannels);
+            neighborTable.assign((IntCalc)numChannels * numSlots, -1);
+            for (IntChannel channel = 0; channel < numChannels; channel++)
+            {
+                const vector<IntChannel> &neighbors = pLayout->getNeighbors(channel); // sorted by channel
+                transform(neighbors.begin(), neighbors.end(), neighborTable.begin() + channel * numSlots,
+                          [inputChannels](IntChannel neighbor)
+                          { return inputChannels[neighbor]; }); // as reported, runs stay on the compact layout
+                for (IntChannel neighbor : neighbors)
+                {
+                    vector<ChannelRun> &runs = neighborRuns[channel];
+                    if (!runs.empty() && runs.back().first + runs.back().second == neighbor)
+                    {
+                        runs.back().second++;
+                    }
+                    else
+                    {
+                        runs.emplace_back(neighbor, 1);
+                    }
+                }
+            }
+
+            Snapshot::openKept(channelFile, getChannelFilename(filename));
+        }
+
+        if (!compress)
+        {
+            return;
+        }
+
+        ShapeCodec::Header header = {};
+        memcpy(header.magic, ShapeCodec::headerMagic, sizeof(header.magic));
+        header.cutoutLen = cutoutLen;
+        header.numChannels = pLayout == nullptr ? 0 : numSlots;
+        header.sampleBytes = sizeof(IntVolt);
+        header.isFloat = is_floating_point_v<IntVolt>;
+        header.blockSpikes = ShapeCodec::blockSpikes;
+        spikeFile.write((const char *)&header, sizeof(header));
+
+        block.reserve((size_t)ShapeCodec::blockSpikes * cutoutSize);
+        compressor = thread(&SpikeShapeWriter::compressLoop, this);
+    }
 
     SpikeShapeWriter::~SpikeShapeWriter()
     {
+        if (compress)
+        {
+            if (!block.empty())
+            {
+                submitBlock();
+            }
+            {
+                lock_guard<mutex> lock(pendingMutex);
+                closing = true;
+            }
+            pendingChanged.notify_all();
+            compressor.join();
+
+            ShapeCodec::Footer footer = {};
+            footer.numSpikes = numSpikes;
+            footer.indexOffset = spikeFile.tellp();
+            memcpy(footer.magic, ShapeCodec::footerMagic, sizeof(footer.magic));
+            spikeFile.write((const char *)blockOffsets.data(), blockOffsets.size() * sizeof(uint64_t));
+            spikeFile.write((const char *)&footer, sizeof(footer));
+        }
+
         delete[] buffer;
-        spikeFile.close();
+        Snapshot::closeAt(spikeFile, filename);
+        if (pLayout != nullptr)
+        {
+            Snapshot::closeAt(channelFile, getChannelFilename(filename));
+        }
     }
 
-    void SpikeShapeWriter::operator()(Spike *pSpike)
+    string SpikeShapeWriter::getChannelFilename(const string &filename)
     {
-        IntFrame cutoutStart = pSpike->frame - this->cutoutStart;
-        for (IntFrame t = 0; t < cutoutLen; t++)
+        return filesystem::path(filename).replace_extension(".channels.bin").string();
+    }
+
+    void SpikeShapeWriter::submitBlock()
+    {
+        vector<IntVolt> full;
+        full.reserve((size_t)ShapeCodec::blockSpikes * cutoutSize);
+        full.swap(block); // keep a reserved buffer for filling
+
+        {
+            unique_lock<mutex> lock(pendingMutex);
+            pendingChanged.wait(lock, [this]
+                                { return pending.size() < maxPending; }); // backpressure if compressor lags
+            pending.push_back(move(full));
+            numInFlight++;
+        }
+        pendingChanged.notify_all();
+    }
+
+    void SpikeShapeWriter::compressLoop()
+    {
+        vector<uint8_t> packed;
+        vector<uint64_t> deltaBuffer;
+
+        while (true)
+        {
+            vector<IntVolt> shapes;
+            {
+                unique_lock<mutex> lock(pendingMutex);
+                pendingChanged.wait(lock, [this]
+                                    { return !pending.empty() || closing; });
+                if (pending.empty()) // closing and drained
+                {
+                    break;
+                }
+                shapes = move(pending.front());
+                pending.pop_front();
+            }
+            pendingChanged.notify_all();
+
+            ShapeCodec::BlockHeader blockHeader = {};
+            blockHeader.numSpikes = shapes.size() / cutoutSize;
+
+            packed.clear();
+            ShapeCodec::encode(shapes.data(), blockHeader.numSpikes, cutoutLen, numSlots, packed, deltaBuffer);
+            blockHeader.payloadBytes = packed.size();
+
+            blockOffsets.push_back(spikeFile.tellp());
+            spikeFile.write((const char *)&blockHeader, sizeof(blockHeader));
+            spikeFile.write((const char *)packed.data(), packed.size());
+            numSpikes += blockHeader.numSpikes;
+
+            {
+                lock_guard<mutex> lock(pendingMutex);
+                numInFlight--;
+            }
+            pendingChanged.notify_all();
+        }
+    }
+
+    void SpikeShapeWriter::saveState(ostream &out)
+    {
+        unique_lock<mutex> lock(pendingMutex);
+        pendingChanged.wait(lock, [this]
+                            { return numInFlight == 0; }); // compressor idle, files not touched by it
+
+        spikeFile.flush();
+        Snapshot::write(out, (IntCalc)spikeFile.tellp());
+        if (pLayout != nullptr)
+        {
+            channelFile.flush();
+        }
+        Snapshot::write(out, (IntCalc)(pLayout == nullptr ? 0 : (streamoff)channelFile.tellp()));
+
+        Snapshot::write(out, numSpikes);
+        Snapshot::write(out, (IntCalc)blockOffsets.size());
+        Snapshot::write(out, blockOffsets.data(), blockOffsets.size());
+        Snapshot::write(out, (IntCalc)block.size());
+        Snapshot::write(out, block.data(), block.size());
+    }
+
+    void SpikeShapeWriter::loadState(istream &in)
+    {
+        IntCalc spikeOffset = Snapshot::read<IntCalc>(in);
+        IntCalc channelOffset = Snapshot::read<IntCalc>(in);
+
+        // the content before the offsets should be kept since the snapshot
+        if (spikeFile.seekp(0, ios::end).tellp() < spikeOffset ||
+            (pLayout != nullptr && channelFile.seekp(0, ios::end).tellp() < channelOffset))
+        {
+            throw runtime_error("SpikeShapeWriter: shape file shorter than in snapshot " + filename);
+        }
+        spikeFile.seekp(spikeOffset);
+        if (pLayout != nullptr)
         {
-            buffer[t] = (*pTrace)(cutoutStart + t, pSpike->channel);
+            channelFile.seekp(channelOffset);
         }
 
-        spikeFile.write((const char *)buffer, cutoutLen * sizeof(IntVolt));
+        lock_guard<mutex> lock(pendingMutex); // compressor idle, nothing submitted yet
+        numSpikes = Snapshot::read<uint64_t>(in);
+        blockOffsets.resize(Snapshot::read<IntCalc>(in));
+        Snapshot::read(in, blockOffsets.data(), blockOffsets.size());
+        block.resize(Snapshot::read<IntCalc>(in));
+        Snapshot::read(in, block.data(), block.size());
     }
 
 } // namespace HSDetection
@@ -1,10 +1,21 @@
 #ifndef SPIKESHAPEWRITER_H
 #define SPIKESHAPEWRITER_H
 
-#include <string>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "ShapeCodec.h"
 #include "SpikeProcessor.h"
+#include "../ProbeLayout.h"
 #include "../RollingArray.h"
 
 namespace HSDetection
@@ -12,23 +23,100 @@ namespace HSDetection
     class SpikeShapeWriter : public SpikeProcessor
     {
     private:
-        std::ofstream spikeFile;
-        IntVolt *buffer; // created and released here
+        std::string filename;   // truncated to the end of writing on close, not on open (to resume)
+        std::fstream spikeFile; // opened for writing without truncation
+        IntVolt *buffer;        // created and released here
 
         const RollingArray *pTrace; // passed in, should not release here
+        const ProbeLayout *pLayout; // passed in, should not release here, nullptr if only peak channel saved
 
         IntFrame cutoutStart;
-        IntFrame cutoutLen; // cutoutStart + 1 + cutoutEnd, 1 is peak frame
+        IntFrame cutoutLen;  // cutoutStart + 1 + cutoutEnd, 1 is peak frame
+        IntChannel numSlots; // channels in each cutout, max number of neighbors (1 if only peak channel)
+        IntCalc cutoutSize;  // samples in each cutout, frames x slots
+
+        // neighborhood cutouts, each frame gathered by row-contiguous runs of neighbor channels
+        typedef std::pair<IntChannel, IntChannel> ChannelRun; // [first, first + len) of neighbors
+        std::vector<std::vector<ChannelRun>> neighborRuns;    // runs for each peak channel
+        std::vector<IntChannel> neighborTable;                // input channels, numChannels x numSlots, padded by -1
+        std::fstream channelFile;                             // channels of each cutout, opened if neighbors
+
+        // compression on a background thread, by blocks of ShapeCodec::blockSpikes shapes
+        static constexpr size_t maxPending = 64; // blocks waiting for compression before blocking the caller
+
+        bool compress;                            // whether to write the compressed format of ShapeCodec
+        std::vector<IntVolt> block;               // shapes of the block being filled
+        std::deque<std::vector<IntVolt>> pending; // full blocks waiting for the compressor
+        std::vector<uint64_t> blockOffsets;       // file offsets of written blocks, for the index
+        uint64_t numSpikes;                       // shapes written
+        IntCalc numInFlight;                      // blocks submitted and not written yet
+        bool closing;                             // no more blocks to come
+        std::mutex pendingMutex;                  // guards pending, numInFlight and closing
+        std::condition_variable pendingChanged;   // signaled on push to or pop from pending
+        std::thread compressor;                   // started if compress
+
+        void submitBlock();  // hand the filled block to the compressor
+        void compressLoop(); // body of the compressor thread
 
     public:
         SpikeShapeWriter(const std::string &filename, const RollingArray *pTrace,
-                         IntFrame cutoutStart, IntFrame cutoutEnd);
+                         const ProbeLayout *pLayout, const IntChannel *inputChannels,
+                         IntFrame cutoutStart, IntFrame cutoutEnd, bool compress);
         ~SpikeShapeWriter();
 
-        using SpikeProcessor::operator(); // allow call on iterator
-        void operator()(Spike *pSpike);
+        inline void operator()(Spike *pSpike);
+
+        IntCalc getCutoutBytes() const { return cutoutSize * sizeof(IntVolt); } // given for each spike, before compression
+
+        static std::string getChannelFilename(const std::string &filename); // file of channel index beside shapes
+
+        // offsets in files and the block being filled, files flushed so that the offsets are on disk
+        void saveState(std::ostream &out);
+        void loadState(std::istream &in);
     };
 
+    // defined in header to be inlined into the specialized pipeline
+    void SpikeShapeWriter::operator()(Spike *pSpike)
+    {
+        IntFrame cutoutStart = pSpike->frame - this->cutoutStart;
+        if (pLayout == nullptr)
+        {
+            for (IntFrame t = 0; t < cutoutLen; t++)
+            {
+                buffer[t] = (*pTrace)(cutoutStart + t, pSpike->channel);
+            }
+        }
+        else
+        {
+            const std::vector<ChannelRun> &runs = neighborRuns[pSpike->channel];
+            for (IntFrame t = 0; t < cutoutLen; t++)
+            {
+                const IntVolt *row = (*pTrace)[cutoutStart + t];
+                IntVolt *slot = buffer + t * numSlots;
+                for (const ChannelRun &run : runs)
+                {
+                    slot = std::copy_n(row + run.first, run.second, slot);
+                }
+                std::fill(slot, buffer + (t + 1) * numSlots, (IntVolt)0);
+            }
+
+            channelFile.write((const char *)(neighborTable.data() + pSpike->channel * numSlots),
+                              numSlots * sizeof(IntChannel));
+        }
+
+        if (compress)
+        {
+            block.insert(block.end(), buffer, buffer + cutoutSize);
+            if (block.size() == (size_t)ShapeCodec::blockSpikes * cutoutSize)
+            {
+                submitBlock();
+            }
+            return;
+        }
+
+        spikeFile.write((const char *)buffer, cutoutSize * sizeof(IntVolt));
+    }
+
 } // namespace HSDetection
 
 #endif
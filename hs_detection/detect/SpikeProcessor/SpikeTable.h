@@ -0,0 +1,54 @@
+#ifndef SPIKETABLE_H
+#define SPIKETABLE_H
+
+#include <cstdint>
+
+#include "../Types.h"
+
+namespace HSDetection
+{
+    // columnar spike table, written by SpikeTableWriter and memory-mapped by readers (hs_detection/spike_table.py):
+    // header, blocks of up to blockSpikes spikes, index of blocks, footer
+    // each block has its columns in turn, each starting at a multiple of columnAlign in the file:
+    // frame (int32), channel (int32), amplitude (IntVolt), and x,y (float32 pairs) if located
+    class SpikeTable
+    {
+    public:
+        static constexpr char headerMagic[8] = {'H', 'S', 'T', 'A', 'B', 'L', 'E', '1'};
+        static constexpr char footerMagic[8] = {'H', 'S', 'T', 'I', 'N', 'D', 'X', '1'};
+        static constexpr uint32_t blockSpikes = 1 << 16; // spikes in a full block, the unit of writing and lookup
+        static constexpr uint64_t columnAlign = 64;      // alignment of columns, for views without copy
+
+        struct Header // padded to columnAlign, so that the first block is aligned
+        {
+            char magic[8];
+            uint32_t sampleBytes; // sizeof(IntVolt) of the writer
+            uint32_t isFloat;     // whether IntVolt is float
+            uint32_t blockSpikes; // max spikes in each block
+            uint32_t hasLocation; // whether blocks have the x,y column
+            char reserved[40];
+        };
+
+        struct BlockEntry // one for each block in the index, in order of writing
+        {
+            uint64_t offset;     // file offset of the frame column, the others follow
+            uint32_t numSpikes;  // spikes in this block
+            int32_t frameStart;  // min frame in this block
+            int32_t frameEnd;    // max frame + 1, ranges of blocks may overlap by the emission order
+            uint32_t reserved;
+        };
+
+        struct Footer
+        {
+            uint64_t numSpikes;   // spikes in the file
+            uint64_t numBlocks;   // entries in the index
+            uint64_t indexOffset; // file offset of the index
+            char magic[8];
+        };
+
+        static constexpr uint64_t alignColumn(uint64_t bytes) { return (bytes + columnAlign - 1) / columnAlign * columnAlign; }
+    };
+
+} // namespace HSDetection
+
+#endif
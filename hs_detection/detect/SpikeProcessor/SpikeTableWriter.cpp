@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "SpikeTableWriter.h"
+#include "../Snapshot.h"
+
+using namespace std;
+
+namespace HSDetection
+{
+    SpikeTableWriter::SpikeTableWriter(const string &filename, bool hasLocation)
+        : filename(filename), tableFile(), hasLocation(hasLocation),
+          frames(), channels(), amplitudes(), locations(), index(), numSpikes(0)
+    {
+        Snapshot::openKept(tableFile, filename);
+
+        SpikeTable::Header header = {};
+        memcpy(header.magic, SpikeTable::headerMagic, sizeof(header.magic));
+        header.sampleBytes = sizeof(IntVolt);
+        header.isFloat = is_floating_point_v<IntVolt>;
+        header.blockSpikes = SpikeTable::blockSpikes;
+        header.hasLocation = hasLocation;
+        tableFile.write((const char *)&header, sizeof(header));
+
+        frames.reserve(SpikeTable::blockSpikes);
+        channels.reserve(SpikeTable::blockSpikes);
+        amplitudes.reserve(SpikeTable::blockSpikes);
+        if (hasLocation)
+        {
+            locations.reserve(SpikeTable::blockSpikes * 2);
+        }
+    }
+
+    SpikeTableWriter::~SpikeTableWriter()
+    {
+        if (!frames.empty())
+        {
+            writeBlock();
+        }
+
+        SpikeTable::Footer footer = {};
+        footer.numSpikes = numSpikes;
+        footer.numBlocks = index.size();
+        footer.indexOffset = tableFile.tellp();
+        memcpy(footer.magic, SpikeTable::footerMagic, sizeof(footer.magic));
+        tableFile.write((const char *)index.data(), index.size() * sizeof(SpikeTable::BlockEntry));
+        tableFile.write((const char *)&footer, sizeof(footer));
+
+        Snapshot::closeAt(tableFile, filename);
+    }
+
+    void SpikeTableWriter::writeColumn(const void *data, uint64_t bytes)
+    {
+        static constexpr char padding[SpikeTable::columnAlign] = {};
+
+        tableFile.write((const char *)data, bytes);
+        tableFile.write(padding, SpikeTable::alignColumn(bytes) - bytes);
+    }
+
+    void SpikeTableWriter::writeBlock()
+    {
+        SpikeTable::BlockEntry entry = {};
+        entry.offset = tableFile.tellp();
+        entry.numSpikes = frames.size();
+        entry.frameStart = *min_element(frames.begin(), frames.end());
+        entry.frameEnd = *max_element(frames.begin(), frames.end()) + 1;
+        index.push_back(entry);
+
+        writeColumn(frames.data(), frames.size() * sizeof(int32_t));
+        writeColumn(channels.data(), channels.size() * sizeof(int32_t));
+        writeColumn(amplitudes.data(), amplitudes.size() * sizeof(IntVolt));
+        if (hasLocation)
+        {
+            writeColumn(locations.data(), locations.size() * sizeof(float));
+        }
+        numSpikes += frames.size();
+
+        frames.clear(); // reset for next block but keep capacity
+        channels.clear();
+        amplitudes.clear();
+        locations.clear();
+    }
+
+    void SpikeTableWriter::saveState(ostream &out)
+    {
+        tableFile.flush();
+        Snapshot::write(out, (IntCalc)tableFile.tellp());
+
+        Snapshot::write(out, numSpikes);
+        Snapshot::write(out, (IntCalc)index.size());
+        Snapshot::write(out, index.data(), index.size());
+        Snapshot::write(out, (IntCalc)frames.size());
+        Snapshot::write(out, frames.data(), frames.size());
+        Snapshot::write(out, channels.data(), channels.size());
+        Snapshot::write(out, amplitudes.data(), amplitudes.size());
+        Snapshot::write(out, locations.data(), locations.size());
+    }
+
+    void SpikeTableWriter::loadState(istream &in)
+    {
+        IntCalc tableOffset = Snapshot::read<IntCalc>(in);
+
+        // the content before the offset should be kept since the snapshot
+        if (tableFile.seekp(0, ios::end).tellp() < tableOffset)
+        {
+            throw runtime_error("SpikeTableWriter: table file shorter than in snapshot " + filename);
+        }
+        tableFile.seekp(tableOffset);
+
+        numSpikes = Snapshot::read<uint64_t>(in);
+        index.resize(Snapshot::read<IntCalc>(in));
+        Snapshot::read(in, index.data(), index.size());
+        IntCalc numPending = Snapshot::read<IntCalc>(in);
+        frames.resize(numPending);
+        channels.resize(numPending);
+        amplitudes.resize(numPending);
+        locations.resize(hasLocation ? numPending * 2 : 0);
+        Snapshot::read(in, frames.data(), frames.size());
+        Snapshot::read(in, channels.data(), channels.size());
+        Snapshot::read(in, amplitudes.data(), amplitudes.size());
+        Snapshot::read(in, locations.data(), locations.size());
+    }
+
+} // namespace HSDetection
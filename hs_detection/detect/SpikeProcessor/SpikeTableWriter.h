@@ -0,0 +1,65 @@
+#ifndef SPIKETABLEWRITER_H
+#define SPIKETABLEWRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "SpikeProcessor.h"
+#include "SpikeTable.h"
+
+namespace HSDetection
+{
+    class SpikeTableWriter : public SpikeProcessor
+    {
+    private:
+        std::string filename;   // truncated to the end of writing on close, not on open (to resume)
+        std::fstream tableFile; // opened for writing without truncation
+        bool hasLocation;       // whether to write the x,y column
+
+        // columns of the block being filled, written when full so that memory stays bounded
+        std::vector<int32_t> frames;
+        std::vector<int32_t> channels;
+        std::vector<IntVolt> amplitudes;
+        std::vector<float> locations; // x,y of each spike
+
+        std::vector<SpikeTable::BlockEntry> index; // blocks written
+        uint64_t numSpikes;                        // spikes written
+
+        void writeBlock(); // write the filled columns as a block
+        void writeColumn(const void *data, uint64_t bytes);
+
+    public:
+        SpikeTableWriter(const std::string &filename, bool hasLocation);
+        ~SpikeTableWriter();
+
+        inline void operator()(const Spike *pSpike);
+
+        // offset in file, index and the block being filled, file flushed so that the offset is on disk
+        void saveState(std::ostream &out);
+        void loadState(std::istream &in);
+    };
+
+    // defined in header to be inlined into the specialized pipeline
+    void SpikeTableWriter::operator()(const Spike *pSpike)
+    {
+        frames.push_back(pSpike->frame);
+        channels.push_back(pSpike->channel);
+        amplitudes.push_back(pSpike->amplitude);
+        if (hasLocation)
+        {
+            locations.push_back(pSpike->position.x);
+            locations.push_back(pSpike->position.y);
+        }
+
+        if (frames.size() == SpikeTable::blockSpikes)
+        {
+            writeBlock();
+        }
+    }
+
+} // namespace HSDetection
+
+#endif
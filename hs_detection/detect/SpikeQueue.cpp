@@ -1,108 +1,242 @@
 #include <algorithm>
+#include <limits>
 
 #include "SpikeQueue.h"
 #include "Detection.h"
-#include "QueueProcessor/FirstElemProcessor.h"
+#include "Snapshot.h"
 #include "QueueProcessor/MaxSpikeFinder.h"
 #include "QueueProcessor/SpikeDecayFilterer.h"
 #include "QueueProcessor/SpikeFilterer.h"
 #include "SpikeProcessor/SpikeLocalizer.h"
 #include "SpikeProcessor/SpikeShapeWriter.h"
+#include "SpikeProcessor/SpikeTableWriter.h"
 
 using namespace std;
 
-#define pushFirstElemProc(pSpkProc)                  \
-    do                                               \
-    {                                                \
-        spkProcs.push_back(pSpkProc);                \
-        pQueProc = new FirstElemProcessor(pSpkProc); \
-        queProcs.push_back(pQueProc);                \
-    } while (false)
+#define procUntilOf(decayFilter, localize, saveShape) \
+    &SpikeQueue::procUntil<decayFilter, localize, saveShape>
 
 namespace HSDetection
 {
-    SpikeQueue::SpikeQueue(Detection *pDet)
-        : spikes((Spike *)new char[pDet->chunkSize * pDet->numChannels * sizeof(Spike)]), spikeCnt(0),
-          queue(), queProcs(), spkProcs(), pRresult(&pDet->result),
-          procDelay(max(pDet->cutoutEnd - pDet->spikeDur, pDet->riseDur) + pDet->temporalJitter + 1)
+    const SpikeQueue::ProcUntil SpikeQueue::procUntilTable[2][2][2] = {
+        {{procUntilOf(false, false, false), procUntilOf(false, false, true)},
+         {procUntilOf(false, true, false), procUntilOf(false, true, true)}},
+        {{procUntilOf(true, false, false), procUntilOf(true, false, true)},
+         {procUntilOf(true, true, false), procUntilOf(true, true, true)}}};
+
+    SpikeQueue::SpikeQueue(Detection *pDet, int config)
+        : threadBuffers(), chunkSize(pDet->chunkSize), queue(),
+          pMaxFinder(nullptr), pFilterer(nullptr), pDecayFilterer(nullptr),
+          pLocalizer(nullptr), pShapeWriter(nullptr), pTableWriter(nullptr), pRresult(&pDet->results[config]), pStats(&pDet->stats),
+          inputChannels(pDet->inputChannels),
+          spikeDur(pDet->spikeDur),
+          procDelay(getProcDelay(pDet->spikeDur, pDet->riseDur, pDet->configs[config].temporalJitter,
+                                 pDet->cutoutEnd)),
+          pProcUntil(procUntilTable[pDet->decayFilter][pDet->localize][pDet->saveShape])
     {
-        SpikeProcessor *pSpkProc;
-        QueueProcessor *pQueProc;
+        IntFrame temporalJitter = pDet->configs[config].temporalJitter;
 
-        pQueProc = new MaxSpikeFinder(&pDet->probeLayout, pDet->temporalJitter);
-        queProcs.push_back(pQueProc);
+        pMaxFinder = new MaxSpikeFinder(&pDet->probeLayout, temporalJitter);
 
         if (pDet->decayFilter)
         {
-            pQueProc = new SpikeDecayFilterer(&pDet->probeLayout, pDet->temporalJitter, pDet->decayRatio);
+            pDecayFilterer = new SpikeDecayFilterer(&pDet->probeLayout, temporalJitter, pDet->decayRatio);
         }
         else
         {
-            pQueProc = new SpikeFilterer(&pDet->probeLayout, pDet->temporalJitter);
+            pFilterer = new SpikeFilterer(&pDet->probeLayout, temporalJitter);
         }
-        queProcs.push_back(pQueProc);
 
         if (pDet->localize)
         {
-            pSpkProc = new SpikeLocalizer(&pDet->probeLayout, &pDet->trace, &pDet->commonRef, &pDet->runningBaseline,
-                                          pDet->temporalJitter, pDet->riseDur);
-            pushFirstElemProc(pSpkProc);
+            pLocalizer = new SpikeLocalizer(&pDet->probeLayout, &pDet->trace, &pDet->commonRef, &pDet->runningBaseline,
+                                            temporalJitter, pDet->riseDur);
         }
 
         if (pDet->saveShape)
         {
-            pSpkProc = new SpikeShapeWriter(pDet->filename, &pDet->trace, pDet->cutoutStart, pDet->cutoutEnd);
-            pushFirstElemProc(pSpkProc);
+            pShapeWriter = new SpikeShapeWriter(config == 0 ? pDet->filename
+                                                            : Detection::getSweepFilename(pDet->filename, config),
+                                                &pDet->trace,
+                                                pDet->neighborShape ? &pDet->probeLayout : nullptr, pDet->inputChannels,
+                                                pDet->cutoutStart, pDet->cutoutEnd, pDet->compressShape);
+        }
+
+        if (!pDet->tableFilename.empty())
+        {
+            pTableWriter = new SpikeTableWriter(config == 0 ? pDet->tableFilename
+                                                            : Detection::getSweepFilename(pDet->tableFilename, config),
+                                                pDet->localize);
         }
     }
 
     SpikeQueue::~SpikeQueue()
     {
-        // should release QueueProc first because SpikeProc can be wrapped inside
-        for_each(queProcs.begin(), queProcs.end(),
-                 [](QueueProcessor *pQueProc)
-                 { delete pQueProc; });
-        for_each(spkProcs.begin(), spkProcs.end(),
-                 [](SpikeProcessor *pSpkProc)
-                 { delete pSpkProc; });
-
-        delete[](char *) spikes;
+        delete pMaxFinder;
+        delete pFilterer;
+        delete pDecayFilterer;
+        delete pLocalizer;
+        delete pShapeWriter;
+        delete pTableWriter;
     }
 
+    template <bool decayFilter, bool localize, bool saveShape>
     void SpikeQueue::procFront()
     {
-        for_each(queProcs.begin(), queProcs.end(),
-                 [this](QueueProcessor *pQueProc)
-                 { (*pQueProc)(this); });
+        double procStart = collectStats ? statsClock() : 0;
+
+        (*pMaxFinder)(this);
+
+        double filterStart = collectStats ? statsClock() : 0;
+
+        if constexpr (decayFilter)
+        {
+            (*pDecayFilterer)(this);
+        }
+        else
+        {
+            (*pFilterer)(this);
+        }
+
+        double localizeStart = collectStats ? statsClock() : 0;
+
+        if constexpr (localize)
+        {
+            (*pLocalizer)(&queue.front());
+        }
+
+        double shapeStart = collectStats ? statsClock() : 0;
+
+        if constexpr (saveShape)
+        {
+            (*pShapeWriter)(&queue.front());
+        }
+
+        if constexpr (collectStats)
+        {
+            double procEnd = statsClock();
+            pStats->finderTime += filterStart - procStart;
+            pStats->filterTime += localizeStart - filterStart;
+            pStats->localizeTime += shapeStart - localizeStart;
+            pStats->shapeTime += procEnd - shapeStart;
+            pStats->numEmitted++;
+            if constexpr (saveShape)
+            {
+                pStats->shapeBytes += pShapeWriter->getCutoutBytes();
+            }
+        }
 
         pRresult->push_back(move(*queue.begin()));
+        pRresult->back().channel = inputChannels[pRresult->back().channel]; // compact channels only inside
         queue.erase(queue.begin());
+
+        if (pTableWriter != nullptr) // committed as reported
+        {
+            (*pTableWriter)(&pRresult->back());
+        }
     }
 
-    void SpikeQueue::process()
+    template <bool decayFilter, bool localize, bool saveShape>
+    void SpikeQueue::procUntil(IntFrame frameBound)
     {
-        sort(spikes, spikes + spikeCnt,
-             [](const Spike &lhs, const Spike &rhs)
-             { return lhs.frame < rhs.frame || (lhs.frame == rhs.frame && lhs.channel < rhs.channel); });
+        while (!queue.empty() && queue.front().frame < frameBound)
+        {
+            procFront<decayFilter, localize, saveShape>();
+        }
+    }
 
-        for (IntResult i = 0; i < spikeCnt; i++)
+    void SpikeQueue::process(IntFrame chunkEnd)
+    {
+        // each thread buffer is sorted already, because a thread owns contiguous channels and walks frames in order,
+        // and threads own channels in ascending order, so k-way merge gives the order of frame then channel
+        typedef pair<Spike *, Spike *> Range; // [begin, end) of unmerged spikes in one thread
+        vector<Range> heads;
+        for (ThreadBuffer &buffer : threadBuffers)
         {
-            while (!queue.empty() && queue.front().frame < spikes[i].frame - procDelay)
+            if (!buffer.spikes.empty())
             {
-                procFront();
+                heads.emplace_back(buffer.spikes.data(), buffer.spikes.data() + buffer.spikes.size());
             }
+        }
+
+        auto later = [](const Range &lhs, const Range &rhs) // min-heap on the first spike
+        { return lhs.first->frame > rhs.first->frame ||
+                 (lhs.first->frame == rhs.first->frame && lhs.first->channel > rhs.first->channel); };
+        make_heap(heads.begin(), heads.end(), later);
 
-            queue.push_back(move(spikes[i]));
+        while (!heads.empty())
+        {
+            pop_heap(heads.begin(), heads.end(), later);
+            Spike *pSpike = heads.back().first++;
+
+            (this->*pProcUntil)(pSpike->frame - procDelay);
+
+            queue.push_back(move(*pSpike));
+
+            if constexpr (collectStats)
+            {
+                pStats->numDetected++;
+                pStats->peakQueueLen = max(pStats->peakQueueLen, (IntCalc)queue.size());
+            }
+
+            if (heads.back().first == heads.back().second)
+            {
+                heads.pop_back();
+            }
+            else
+            {
+                push_heap(heads.begin(), heads.end(), later);
+            }
+        }
+
+        for (ThreadBuffer &buffer : threadBuffers)
+        {
+            buffer.spikes.clear(); // reset for next chunk but keep capacity
         }
 
-        spikeCnt = 0; // reset for next chunk
+        // all spikes peaked before chunkEnd - spikeDur are pushed, so those earlier than that by procDelay
+        // can be processed now, independent of how frames are split into chunks
+        (this->*pProcUntil)(chunkEnd - spikeDur - procDelay);
     }
 
     void SpikeQueue::finalize()
     {
-        while (!queue.empty())
+        (this->*pProcUntil)(numeric_limits<IntFrame>::max()); // process all
+    }
+
+    void SpikeQueue::saveState(ostream &out)
+    {
+        Snapshot::write(out, (IntCalc)queue.size());
+        for (const Spike &spike : queue)
+        {
+            Snapshot::writeSpike(out, spike);
+        }
+
+        if (pShapeWriter != nullptr)
+        {
+            pShapeWriter->saveState(out);
+        }
+        if (pTableWriter != nullptr)
+        {
+            pTableWriter->saveState(out);
+        }
+    }
+
+    void SpikeQueue::loadState(istream &in)
+    {
+        queue.clear();
+        for (IntCalc i = Snapshot::read<IntCalc>(in); i > 0; i--)
+        {
+            queue.push_back(Snapshot::readSpike(in));
+        }
+
+        if (pShapeWriter != nullptr)
+        {
+            pShapeWriter->loadState(in);
+        }
+        if (pTableWriter != nullptr)
         {
-            procFront();
+            pTableWriter->loadState(in);
         }
     }
 
@@ -1,39 +1,88 @@
 #ifndef SPIKEQUEUE_H
 #define SPIKEQUEUE_H
 
+#include <algorithm>
+#include <iosfwd>
 #include <list>
 #include <vector>
 #include <utility>
 
+#include "DetectionStats.h"
 #include "Spike.h"
 
 namespace HSDetection
 {
     class Detection;
-    class QueueProcessor;
-    class SpikeProcessor;
+    class MaxSpikeFinder;
+    class SpikeFilterer;
+    class SpikeDecayFilterer;
+    class SpikeLocalizer;
+    class SpikeShapeWriter;
+    class SpikeTableWriter;
+    struct DetectionStages;
     // no include in header to avoid cyclic dependency
 
     class SpikeQueue
     {
     private:
-        Spike *spikes;      // buffer for detected spikes
-        IntResult spikeCnt; // count of detected spikes
+        friend DetectionStages; // allow benchmarks and checks on single stages (tests/cpp_mode/DetectionStages.h)
+
+        // per-thread staging buffer of detected spikes, aligned to avoid false sharing
+        // indexed by the part of channel partition, which is owned by one thread
+        struct alignas(64) ThreadBuffer
+        {
+            std::vector<Spike> spikes; // capacity kept across chunks as a pool, grows if overflow
+        };
+
+        static constexpr IntFrame expectSpikeInterval = 1000; // expected frames between spikes on a channel
+
+        std::vector<ThreadBuffer> threadBuffers; // one for each thread in the parallel region
+        IntFrame chunkSize;                      // frames in a chunk, used to size buffers
 
         std::list<Spike> queue; // list has constant-time erase and also bi-directional iter
 
-        std::vector<QueueProcessor *> queProcs; // content created and released here
-        std::vector<SpikeProcessor *> spkProcs; // content created and released here
+        MaxSpikeFinder *pMaxFinder;         // created and released here
+        SpikeFilterer *pFilterer;           // created and released here, nullptr if not used
+        SpikeDecayFilterer *pDecayFilterer; // created and released here, nullptr if not used
+        SpikeLocalizer *pLocalizer;         // created and released here, nullptr if not used
+        SpikeShapeWriter *pShapeWriter;     // created and released here, nullptr if not used
+        SpikeTableWriter *pTableWriter;     // created and released here, nullptr if not used
 
-        std::vector<Spike> *pRresult; // passed in, should not release here
+        std::vector<Spike> *pRresult;     // passed in, should not release here
+        DetectionStats *pStats;           // passed in, should not release here
+        const IntChannel *inputChannels; // passed in, should not release here, to report the input channel
 
+        IntFrame spikeDur;  // delayed frames from spike peak to push
         IntFrame procDelay; // delayed frames from push to process
 
+        // the pipeline of processors is specialized for each combination of options,
+        // so that all processors are called statically and inlined into one function
+        template <bool decayFilter, bool localize, bool saveShape>
         void procFront();
-        // cannot inline procFront because no definition of Processor here
+        // cannot inline procFront in header because no definition of Processor here
+
+        template <bool decayFilter, bool localize, bool saveShape>
+        void procUntil(IntFrame frameBound); // process front while earlier than frameBound
+
+        typedef void (SpikeQueue::*ProcUntil)(IntFrame frameBound);
+        static const ProcUntil procUntilTable[2][2][2]; // indexed by [decayFilter][localize][saveShape]
+        ProcUntil pProcUntil;                           // selected once from the param set
 
     public:
-        SpikeQueue(Detection *pDet); // passing the whole param set altogether
+        SpikeQueue(Detection *pDet, int config); // passing the whole param set altogether, for one config
+
+        static constexpr IntFrame getProcDelay(IntFrame spikeDur, IntFrame riseDur, IntFrame temporalJitter,
+                                               IntFrame cutoutEnd)
+        {
+            return std::max(cutoutEnd - spikeDur, riseDur) + temporalJitter + 1;
+        }
+        // frames before a chunk that can still be read by processors on the spikes left in queue
+        static constexpr IntFrame getHistoryLen(IntFrame spikeDur, IntFrame riseDur, IntFrame temporalJitter,
+                                                IntFrame cutoutStart, IntFrame cutoutEnd)
+        {
+            return spikeDur + getProcDelay(spikeDur, riseDur, temporalJitter, cutoutEnd) +
+                   std::max({cutoutStart, riseDur, temporalJitter});
+        }
         ~SpikeQueue();
 
         // copy constructor deleted to protect container content
@@ -41,16 +90,23 @@ namespace HSDetection
         // copy assignment deleted to protect container content
         SpikeQueue &operator=(const SpikeQueue &) = delete;
 
-        void addSpike(Spike &&spike)
+        // should be called before any parallel region with the team size
+        void setNumThreads(int numThreads) { threadBuffers.resize(numThreads); }
+        // should be called by each thread before adding spikes, to reserve for the realistic spike rate
+        void reserveThread(int threadNum, IntChannel numChannels)
         {
-            IntResult spkIdx;
-#pragma omp atomic capture
-            spkIdx = spikeCnt++;
-            spikes[spkIdx] = std::move(spike);
+            threadBuffers[threadNum].spikes.reserve((IntCalc)chunkSize * numChannels / expectSpikeInterval + 1);
         }
-        void process();
+
+        // lock-free because each thread appends to its own buffer, always sorted by frame then channel
+        void addSpike(Spike &&spike, int threadNum) { threadBuffers[threadNum].spikes.push_back(std::move(spike)); }
+        void process(IntFrame chunkEnd);
         void finalize();
 
+        // spikes waiting in queue and state of shape writer, at a chunk boundary when thread buffers are empty
+        void saveState(std::ostream &out);
+        void loadState(std::istream &in);
+
         // wrappers of container interface
 
         typedef std::list<Spike>::iterator iterator;
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "BinaryReader.h"
+
+using namespace std;
+
+namespace HSDetection
+{
+    BinaryReader::BinaryReader(const string &filename, IntChannel numChannels,
+                               const string &dtype, IntCalc offset)
+        : sampleType(parseType(dtype)), sampleSize(typeSize(sampleType)), frameOffset(offset)
+    {
+        this->numChannels = numChannels;
+        if (numChannels <= 0 || offset < 0)
+        {
+            throw invalid_argument("BinaryReader: invalid number of channels or offset");
+        }
+
+#ifdef _WIN32
+        file.open(filename, ios::binary);
+        if (!file)
+        {
+            throw runtime_error("BinaryReader: cannot open " + filename);
+        }
+        IntCalc fileSize = file.seekg(0, ios::end).tellg();
+        staging = nullptr;
+        stagingSize = 0;
+#else
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw runtime_error("BinaryReader: cannot open " + filename);
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0)
+        {
+            close(fd);
+            throw runtime_error("BinaryReader: cannot stat " + filename);
+        }
+        IntCalc fileSize = fileStat.st_size;
+
+        mappedSize = fileSize;
+        mapped = mappedSize == 0 ? nullptr
+                                 : (const char *)mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (mappedSize == 0 || mapped == MAP_FAILED)
+        {
+            close(fd);
+            throw runtime_error("BinaryReader: cannot map " + filename);
+        }
+        madvise((void *)mapped, mappedSize, MADV_SEQUENTIAL); // aggressive readahead, early reclaim
+#endif
+
+        numFrames = max(fileSize - frameOffset, (IntCalc)0) / (numChannels * sampleSize);
+    }
+
+    BinaryReader::~BinaryReader()
+    {
+#ifdef _WIN32
+        delete[] staging;
+        file.close();
+#else
+        munmap((void *)mapped, mappedSize);
+        close(fd);
+#endif
+    }
+
+    void BinaryReader::read(FloatRaw *buffer, IntFrame frameStart, IntFrame frameLen)
+    {
+        IntFrame validStart = min(max(frameStart, 0), numFrames);
+        IntFrame validEnd = min(max(frameStart + frameLen, 0), numFrames);
+
+        fill(buffer, buffer + (IntCalc)(validStart - frameStart) * numChannels, (FloatRaw)0);
+        fill(buffer + (IntCalc)(max(validEnd, validStart) - frameStart) * numChannels,
+             buffer + (IntCalc)frameLen * numChannels, (FloatRaw)0);
+        if (validEnd <= validStart)
+        {
+            return;
+        }
+
+        IntCalc numSamples = (IntCalc)(validEnd - validStart) * numChannels;
+        IntCalc byteStart = frameOffset + (IntCalc)validStart * numChannels * sampleSize;
+
+#ifdef _WIN32
+        if (stagingSize < numSamples * sampleSize)
+        {
+            delete[] staging;
+            stagingSize = numSamples * sampleSize;
+            staging = new char[stagingSize];
+        }
+        file.seekg(byteStart).read(staging, numSamples * sampleSize);
+        const char *src = staging;
+#else
+        const char *src = mapped + byteStart;
+
+        // prefetch the next chunk of the same length while this one is converted
+        IntCalc byteEnd = byteStart + numSamples * sampleSize;
+        IntCalc pageMask = ~(IntCalc)(sysconf(_SC_PAGESIZE) - 1);
+        IntCalc aheadStart = byteEnd & pageMask;
+        IntCalc aheadEnd = min(byteEnd + numSamples * sampleSize, mappedSize);
+        if (aheadStart < aheadEnd)
+        {
+            madvise((void *)(mapped + aheadStart), aheadEnd - aheadStart, MADV_WILLNEED);
+        }
+#endif
+
+        FloatRaw *dst = buffer + (IntCalc)(validStart - frameStart) * numChannels;
+        switch (sampleType)
+        {
+        case Int16:
+            convert<int16_t>(dst, src, numSamples);
+            break;
+        case UInt16:
+            convert<uint16_t>(dst, src, numSamples);
+            break;
+        case Int32:
+            convert<int32_t>(dst, src, numSamples);
+            break;
+        case Float32:
+            convert<float>(dst, src, numSamples);
+            break;
+        case Float64:
+            convert<double>(dst, src, numSamples);
+            break;
+        }
+    }
+
+    template <typename T>
+    void BinaryReader::convert(FloatRaw *buffer, const char *src, IntCalc numSamples)
+    {
+        for (IntCalc i = 0; i < numSamples; i++)
+        {
+            T sample;
+            memcpy(&sample, src + i * sizeof(T), sizeof(T)); // header may leave samples unaligned
+            buffer[i] = sample;
+        }
+    }
+
+    BinaryReader::SampleType BinaryReader::parseType(const string &dtype)
+    {
+        // names as numpy dtype
+        if (dtype == "int16")
+        {
+            return Int16;
+        }
+        if (dtype == "uint16")
+        {
+            return UInt16;
+        }
+        if (dtype == "int32")
+        {
+            return Int32;
+        }
+        if (dtype == "float32")
+        {
+            return Float32;
+        }
+        if (dtype == "float64")
+        {
+            return Float64;
+        }
+        throw invalid_argument("BinaryReader: unsupported dtype " + dtype);
+    }
+
+    IntCalc BinaryReader::typeSize(SampleType type)
+    {
+        switch (type)
+        {
+        case Int16:
+        case UInt16:
+            return 2;
+        case Int32:
+        case Float32:
+            return 4;
+        case Float64:
+            return 8;
+        }
+        return 0;
+    }
+
+} // namespace HSDetection
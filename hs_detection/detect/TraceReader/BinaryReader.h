@@ -0,0 +1,56 @@
+#ifndef BINARYREADER_H
+#define BINARYREADER_H
+
+#include <string>
+#include <fstream>
+
+#include "TraceReader.h"
+
+namespace HSDetection
+{
+    // flat binary of interleaved samples (frame-major) after a header of given size,
+    // also covers uncompressed contiguous datasets inside containers (e.g. NWB/HDF5) by the offset
+    class BinaryReader : public TraceReader
+    {
+    public:
+        enum SampleType
+        {
+            Int16,
+            UInt16,
+            Int32,
+            Float32,
+            Float64
+        };
+
+    private:
+        SampleType sampleType;
+        IntCalc sampleSize;  // bytes per sample
+        IntCalc frameOffset; // bytes of header before the first frame
+
+#ifdef _WIN32
+        std::ifstream file; // read by seek, no mmap
+        char *staging;      // raw bytes of a chunk, created and released here
+        IntCalc stagingSize;
+#else
+        int fd;
+        const char *mapped; // whole file mapped read-only, released here
+        IntCalc mappedSize;
+#endif
+
+        template <typename T>
+        static void convert(FloatRaw *buffer, const char *src, IntCalc numSamples);
+
+    public:
+        BinaryReader(const std::string &filename, IntChannel numChannels,
+                     const std::string &dtype, IntCalc offset);
+        ~BinaryReader();
+
+        void read(FloatRaw *buffer, IntFrame frameStart, IntFrame frameLen) override;
+
+        static SampleType parseType(const std::string &dtype);
+        static IntCalc typeSize(SampleType type);
+    };
+
+} // namespace HSDetection
+
+#endif
@@ -0,0 +1,68 @@
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+#include "MdaReader.h"
+
+using namespace std;
+
+namespace HSDetection
+{
+    MdaReader::Header MdaReader::readHeader(const string &filename)
+    {
+        ifstream file(filename, ios::binary);
+        int32_t typeCode = 0, entrySize = 0, numDims = 0;
+        file.read((char *)&typeCode, sizeof(int32_t))
+            .read((char *)&entrySize, sizeof(int32_t))
+            .read((char *)&numDims, sizeof(int32_t));
+
+        bool largeDims = numDims < 0; // negative for int64 dims
+        numDims = largeDims ? -numDims : numDims;
+        int64_t numChannels = 0;
+        if (largeDims)
+        {
+            file.read((char *)&numChannels, sizeof(int64_t));
+        }
+        else
+        {
+            int32_t dim = 0;
+            file.read((char *)&dim, sizeof(int32_t));
+            numChannels = dim;
+        }
+        if (!file || numDims != 2)
+        {
+            throw runtime_error("MdaReader: expect 2D array in " + filename);
+        }
+
+        // codes defined by MDA format
+        string dtype;
+        switch (typeCode)
+        {
+        case -3:
+            dtype = "float32";
+            break;
+        case -4:
+            dtype = "int16";
+            break;
+        case -5:
+            dtype = "int32";
+            break;
+        case -6:
+            dtype = "uint16";
+            break;
+        case -7:
+            dtype = "float64";
+            break;
+        default:
+            throw runtime_error("MdaReader: unsupported data type in " + filename);
+        }
+        if (entrySize != typeSize(parseType(dtype)))
+        {
+            throw runtime_error("MdaReader: inconsistent entry size in " + filename);
+        }
+
+        IntCalc dimSize = largeDims ? sizeof(int64_t) : sizeof(int32_t);
+        return Header{(IntChannel)numChannels, dtype, 3 * (IntCalc)sizeof(int32_t) + numDims * dimSize};
+    }
+
+} // namespace HSDetection
@@ -0,0 +1,33 @@
+#ifndef MDAREADER_H
+#define MDAREADER_H
+
+#include <string>
+
+#include "BinaryReader.h"
+
+namespace HSDetection
+{
+    // MDA file of 2D array channels x frames, column-major so that frames are interleaved
+    class MdaReader : public BinaryReader
+    {
+    private:
+        struct Header
+        {
+            IntChannel numChannels;
+            std::string dtype;
+            IntCalc headerSize;
+        };
+
+        static Header readHeader(const std::string &filename);
+
+        MdaReader(const std::string &filename, const Header &header)
+            : BinaryReader(filename, header.numChannels, header.dtype, header.headerSize) {}
+
+    public:
+        MdaReader(const std::string &filename) : MdaReader(filename, readHeader(filename)) {}
+        ~MdaReader() {}
+    };
+
+} // namespace HSDetection
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef TRACEREADER_H
+#define TRACEREADER_H
+
+#include "../Types.h"
+
+namespace HSDetection
+{
+    // base of native data sources for Detection::stepFrom, virtual because the format is chosen at runtime
+    // the trace is read as frame-major FloatRaw, the same layout as the buffer passed to Detection::step
+    class TraceReader
+    {
+    protected:
+        IntFrame numFrames;
+        IntChannel numChannels;
+
+    public:
+        TraceReader() : numFrames(0), numChannels(0) {}
+        virtual ~TraceReader() {}
+
+        // copy constructor deleted to protect possible internals
+        TraceReader(const TraceReader &) = delete;
+        // copy assignment deleted to protect possible internals
+        TraceReader &operator=(const TraceReader &) = delete;
+
+        IntFrame getNumFrames() const { return numFrames; }
+        IntChannel getNumChannels() const { return numChannels; }
+
+        // frames beyond the end are filled with zeros
+        virtual void read(FloatRaw *buffer, IntFrame frameStart, IntFrame frameLen) = 0;
+    };
+
+} // namespace HSDetection
+
+#endif
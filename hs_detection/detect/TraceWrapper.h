@@ -12,16 +12,18 @@ namespace HSDetection
 
         IntFrame frameOffset; // offset of current chunk
         IntChannel numChannels;
-        IntFrame chunkSize; // offset advance by this size with each new chunk
 
     public:
-        TraceWrapper(IntFrame leftMargin, IntChannel numChannels, IntFrame chunkSize)
-            : traceBuffer(nullptr), frameOffset(-leftMargin - chunkSize),
-              numChannels(numChannels), chunkSize(chunkSize) {}
+        TraceWrapper(IntChannel numChannels)
+            : traceBuffer(nullptr), frameOffset(0), numChannels(numChannels) {}
         ~TraceWrapper() {}
 
-        // should be called to both provide a buffer and advance the offset
-        void updateChunk(FloatRaw *traceBuffer) { this->traceBuffer = traceBuffer, frameOffset += chunkSize; }
+        // should be called to both provide a buffer and move the offset, chunks can be of any size
+        // the buffer starts at the first frame of chunk, frames before are kept in rolling arrays
+        void updateChunk(FloatRaw *traceBuffer, IntFrame chunkStart)
+        {
+            this->traceBuffer = traceBuffer, frameOffset = chunkStart;
+        }
 
         const FloatRaw *operator[](IntFrame frame) const { return traceBuffer + (IntCalc)(frame - frameOffset) * numChannels; }
         FloatRaw *operator[](IntFrame frame) { return traceBuffer + (IntCalc)(frame - frameOffset) * numChannels; }
@@ -10,7 +10,6 @@ namespace HSDetection
     // used in interface
     typedef int32_t IntFrame;   // number of frames
     typedef int32_t IntChannel; // number of channels
-    typedef int16_t IntVolt;    // quantized voltage
     typedef float FloatRaw;     // raw trace
     typedef float FloatGeom;    // spatial dimension
     typedef float FloatRatio;   // ratio between values
@@ -19,6 +18,22 @@ namespace HSDetection
     // used only internally
     typedef int_fast64_t IntCalc; // internal calc, at least 64bit and fast
 
+    // precision of processing selected at compile time: int16 by default as the fast path,
+    // int32 against saturation by large artifacts, float32 against quantization (not Int then)
+#if defined(HSDETECTION_PRECISION_FLOAT32)
+    typedef float IntVolt;                  // quantized voltage, used in interface
+    typedef float VoltCalc;                 // calc on voltages, e.g. sums and products with thresholds
+    constexpr char voltDtype[] = "float32"; // numpy dtype of IntVolt, for amplitudes and shapes
+#elif defined(HSDETECTION_PRECISION_INT32)
+    typedef int32_t IntVolt;
+    typedef IntCalc VoltCalc;
+    constexpr char voltDtype[] = "int32";
+#else
+    typedef int16_t IntVolt;
+    typedef IntCalc VoltCalc;
+    constexpr char voltDtype[] = "int16";
+#endif
+
 } // namespace HSDetection
 
 #endif
@@ -1,15 +1,20 @@
 from pathlib import Path
-from typing import TypedDict, Union
+from typing import Iterable, Mapping, TypedDict, Union
 
 
 class Params(TypedDict):
     bandpass: bool
     freq_min: float
     freq_max: float
-    chunk_size: int
+    chunk_size: Union[int, str]
+    memory_budget: float
+    numa_aware: bool
     rescale: bool
     rescale_value: float
     common_reference: str
+    fast_init: bool
+    bad_channels: Union[Iterable[int], None]
+    detect_bad_channels: bool
     spike_duration: float
     amp_avg_duration: float
     threshold: float
@@ -19,13 +24,20 @@ class Params(TypedDict):
     inner_radius: float
     peak_jitter: float
     rise_duration: float
+    sweep: Union[Iterable[Mapping[str, float]], None]
+    artifact_fraction: float
     decay_filtering: bool
     decay_ratio: float
     localize: bool
     save_shape: bool
+    compress_shape: bool
+    neighbor_shape: bool
     out_file: Union[str, Path]
     left_cutout_time: float
     right_cutout_time: float
+    table_file: Union[str, Path, None]
+    checkpoint_file: Union[str, Path, None]
+    checkpoint_interval: float
     verbose: bool
 
 
@@ -35,11 +47,17 @@ DEFAULT_PARAMS: Params = {
     'freq_max': 6000.0,
 
     'chunk_size': 100000,
+    'memory_budget': 1024.0,
+    'numa_aware': False,
 
     'rescale': True,
     'rescale_value': -1280.0,
 
     'common_reference': 'average',
+    'fast_init': False,
+
+    'bad_channels': None,
+    'detect_bad_channels': False,
 
     'spike_duration': 1.0,
     'amp_avg_duration': 0.4,
@@ -53,15 +71,26 @@ DEFAULT_PARAMS: Params = {
     'peak_jitter': 0.2,
     'rise_duration': 0.26,
 
+    'sweep': None,
+
+    'artifact_fraction': 0.0,
+
     'decay_filtering': False,
     'decay_ratio': 1.0,
 
     'localize': True,
 
     'save_shape': True,
+    'compress_shape': False,
+    'neighbor_shape': False,
     'out_file': 'HS2_detected',
     'left_cutout_time': 0.3,
     'right_cutout_time': 1.8,
 
+    'table_file': None,
+
+    'checkpoint_file': None,
+    'checkpoint_interval': 600.0,
+
     'verbose': True
 }
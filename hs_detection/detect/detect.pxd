@@ -2,17 +2,42 @@
 # cython: language_level=3
 
 from libc.stdint cimport int32_t as _int32_t
+from libc.stdint cimport int64_t as _int64_t
 from libcpp cimport bool as _bool
 from libcpp.vector cimport vector
 
 cimport numpy as np
+from openmp cimport omp_get_max_threads, omp_set_num_threads
 
-from .Detection cimport Detection, Spike
+from .Detection cimport (BinaryReader, Detection, DetectionConfig, DetectionStats, IntVolt, MdaReader,
+                         ShapeReader, Spike, TraceReader, collectStats, voltDtype)
 
+ctypedef Detection *p_det
+ctypedef TraceReader *p_reader
+ctypedef ShapeReader *p_shape_reader
+
+
+# tuples of (threshold, minAvgAmp, maxAHPAmp, temporalJitter)
+cdef inline vector[DetectionConfig] toConfigs(list sweepConfigs):
+    cdef vector[DetectionConfig] configs
+    cdef DetectionConfig config
+    for sweep in sweepConfigs:
+        config.threshold = sweep[0]
+        config.minAvgAmp = sweep[1]
+        config.maxAHPAmp = sweep[2]
+        config.temporalJitter = sweep[3]
+        configs.push_back(config)
+    return configs
+
+cdef inline _int32_t historyLen(_int32_t spikeDur, _int32_t riseDur, _int32_t temporalJitter,
+                                _int32_t cutoutStart, _int32_t cutoutEnd, list sweepConfigs) except -1:
+    return Detection.getHistoryLen(spikeDur, riseDur, temporalJitter, cutoutStart, cutoutEnd,
+                                   toConfigs(sweepConfigs))
 
 cdef inline Detection* newDet(_int32_t numChannels,
                               _int32_t chunkSize,
                               _int32_t chunkLeftMargin,
+                              _bool numaAware,
                               _bool rescale,
                               const float *scale,
                               const float *offset,
@@ -34,10 +59,17 @@ cdef inline Detection* newDet(_int32_t numChannels,
                               _bool saveShape,
                               bytes filename,
                               _int32_t cutoutStart,
-                              _int32_t cutoutEnd):
+                              _int32_t cutoutEnd,
+                              _bool compressShape,
+                              _bool neighborShape,
+                              const _bool *channelMask,
+                              list sweepConfigs,
+                              bytes tableFilename,
+                              float artifactFraction):
     return new Detection(numChannels,
                          chunkSize,
                          chunkLeftMargin,
+                         numaAware,
                          rescale,
                          scale,
                          offset,
@@ -59,7 +91,38 @@ cdef inline Detection* newDet(_int32_t numChannels,
                          saveShape,
                          filename,
                          cutoutStart,
-                         cutoutEnd)
+                         cutoutEnd,
+                         compressShape,
+                         neighborShape,
+                         channelMask,
+                         toConfigs(sweepConfigs),
+                         tableFilename,
+                         artifactFraction)
 
 cdef inline void delDet(Detection* det):
     del det
+
+cdef inline TraceReader* newBinaryReader(bytes filename, _int32_t numChannels,
+                                        bytes dtype, _int64_t offset) except NULL:
+    return new BinaryReader(filename, numChannels, dtype, offset)
+
+cdef inline TraceReader* newMdaReader(bytes filename) except NULL:
+    return new MdaReader(filename)
+
+cdef inline void delReader(TraceReader* reader):
+    del reader
+
+cdef inline ShapeReader* newShapeReader(bytes filename) except NULL:
+    return new ShapeReader(filename)
+
+cdef inline void delShapeReader(ShapeReader* reader):
+    del reader
+
+# decode straight into the C-contiguous rows of out
+cdef inline int readShapes(ShapeReader* reader, _int64_t spikeStart, _int64_t numSpikes,
+                           np.ndarray out) except -1:
+    reader.read(spikeStart, numSpikes, <IntVolt *> np.PyArray_DATA(out))
+    return 0
+
+cdef inline float[:, ::1] inputView(Detection* det, _int32_t numFrames, _int32_t numChannels):
+    return <float[:numFrames, :numChannels]> det.getInputBuffer()
@@ -2,15 +2,19 @@
 # cython: language_level=3
 # cython: annotation_typing=False
 
+import operator
+import os
 import warnings
 from pathlib import Path
-from typing import Optional
+from time import perf_counter
+from typing import Optional, Union
 
 import cython
 import numpy as np
 from numpy.typing import NDArray
 
 from ..recording import RealArray, Recording
+from ..spike_table import SpikeTable
 from . import DEFAULT_PARAMS as _DEFAULT_PARAMS
 from . import Params
 
@@ -19,9 +23,15 @@ int32_t = cython.typedef(_int32_t)  # type: ignore
 p_i32 = cython.typedef(cython.pointer(int32_t))  # type: ignore
 single = cython.typedef(cython.float)  # type: ignore
 p_single = cython.typedef(cython.p_float)  # type: ignore
+p_bool = cython.typedef(cython.pointer(bool_t))  # type: ignore
 vector_i32 = cython.typedef(vector[int32_t])  # type: ignore
 
 RADIUS_EPS: float = cython.declare(single, 1e-3)  # type: ignore  # 1nm
+# bad channels by the spread (5% to 95%) relative to the median of all channels
+BAD_SPREAD_LOW: float = cython.declare(single, 0.1)  # type: ignore  # dead
+BAD_SPREAD_HIGH: float = cython.declare(single, 10.0)  # type: ignore  # saturated or noisy
+# sample type of processing (precision mode of the C++ build), also of amplitudes and shapes
+VOLT_DTYPE: np.dtype = np.dtype(voltDtype.decode())  # type: ignore
 
 
 @cython.cclass
@@ -40,7 +50,66 @@ class HSDetection(object):
         `recording` (`BaseRecording`): A recording from SpikeInterface.
         `params` (`dict`): A dictionary of algorithmic parameters. All keys \
             must be present (use `HSDetection.DEFAULT_PARAMS` as a start), but \
-            additional keys are accepted and ignored.
+            additional keys are accepted and ignored. The `chunk_size` can be \
+            `'auto'` to select within `memory_budget` (MiB) by a short probe \
+            and to adjust the chunk length between steps.
+
+    Online mode (`open_stream()`, `push()`, `close_stream()`) accepts blocks \
+    of any length as they are acquired, and returns the spikes as soon as \
+    they are final, in the same format as below but without `spike_shape` \
+    (shapes are still appended to the file). The wall time of processing the \
+    last block is in `stream_latency` (seconds).
+
+    If the C++ code is built with `HSDETECTION_STATS` (`STATS` in setup.py), \
+    `stats[segment_index]` has the counters of stages after each segment \
+    (also after `close_stream()`): times in seconds of steps and queue, \
+    per-thread cast/estimate/wait times and their `load_imbalance` (max over \
+    mean of busy time), spikes detected and emitted, peak queue length, mean \
+    time per spike of each processor, and bytes of shapes written. Otherwise \
+    `stats` stays empty.
+
+    The fixed-size buffers of each detection (rolling arrays, per-channel \
+    state) are in one mapping on huge pages where available, except with \
+    `numa_aware`. `footprint[segment_index]` has its `bytes` (with the input \
+    buffer) and the kind of `pages`, after each segment or `close_stream()`.
+
+    With `checkpoint_file`, the state of detection is saved to it (suffixed \
+    by segment like the shape file) every `checkpoint_interval` seconds of \
+    wall time, and a later run with the same params and shape file resumes \
+    from there instead of frame 0. The snapshot is removed when the segment \
+    is done. In online mode, `save_stream()` and `open_stream(resume_file=)` \
+    do the same by hand.
+
+    Channels in `bad_channels` (indices in the recording) and, with \
+    `detect_bad_channels`, those found flat or saturated on calibration \
+    chunks by `find_bad_channels()` are left out of every stage: not cast, \
+    not in the common reference, and not neighbors of any channel.
+
+    With `fast_init`, the running baseline and deviation of each channel \
+    start at their steady state on about a second of the calibration chunks, \
+    instead of converging over the first seconds of each segment or stream, \
+    so that runs started in the middle of a recording need little overlap.
+
+    With `sweep`, a list of dicts overriding some of `threshold`, \
+    `min_avg_amp`, `AHP_thr` and `peak_jitter`, each config is detected in \
+    the same pass, sharing the cast, common reference and running estimation, \
+    with its own detection state and queue. The results have `sweep`, a list \
+    of the same dicts (without the key `sweep`) for each config in order, with \
+    shapes in `out_file` suffixed by `.sweep<k>` (k from 1).
+
+    With `table_file`, the spikes are appended to a columnar table (`.hst`, \
+    suffixed by segment like the shape file) by blocks as they are emitted, \
+    and dropped from memory after each step, so that memory stays bounded on \
+    long recordings. The results are then read back from the table, and \
+    `SpikeTable` memory-maps it for reading by frame range. In online mode, \
+    `push()` still returns the new spikes.
+
+    With `artifact_fraction` >0, frames where at least that fraction of the \
+    channels cross the detection threshold at once (e.g. stimulation or motion \
+    artifacts) are blanked: the running estimation is held over them and no \
+    spike is detected in them. The results have `artifacts`, an (m,2) array \
+    of [start, end) frames of each blanked interval, also returned by `push()` \
+    for the intervals closed since the last call.
 
     Returns (of `HSDetection.detect()`):
         `list[dict[str, np.ndarray]]`: A list of dictionary containing the \
@@ -49,7 +118,12 @@ class HSDetection(object):
         - channel_ind: (n,) array of channel indices
         - amplitude: (n,) array of amplitudes
         - location (optional): (n,2) array of spike locations if localization on
-        - spike_shape (optional): (n,l) array of spike shape if shape saved
+        - spike_shape (optional): (n,l) array of spike shape if shape saved, \
+                (n,l,c) with `neighbor_shape`, `CompressedShapes` if compressed
+        - spike_channels (optional): (n,c) array of channels of each shape \
+                with `neighbor_shape`, -1 for padding
+        - artifacts (optional): (m,2) array of [start, end) frames blanked \
+                with `artifact_fraction`
     """
 
     DEFAULT_PARAMS: Params = _DEFAULT_PARAMS
@@ -60,7 +134,16 @@ class HSDetection(object):
 
     num_channels: int = cython.declare(int32_t)  # type: ignore
     chunk_size: int = cython.declare(int32_t)  # type: ignore
-    left_margin: int = cython.declare(int32_t)  # type: ignore
+    history_len: int = cython.declare(int32_t)  # type: ignore
+
+    auto_chunk: bool = cython.declare(bool_t)  # type: ignore
+    memory_budget: float = cython.declare(single)  # type: ignore
+    chunk_length: int = cython.declare(int32_t)  # type: ignore
+    chunk_candidates: list[int] = cython.declare(list)  # type: ignore
+
+    numa_aware: bool = cython.declare(bool_t)  # type: ignore
+
+    channel_mask: Optional[NDArray[np.bool_]] = cython.declare(object)  # type: ignore
 
     rescale: bool = cython.declare(bool_t)  # type: ignore
     scale: NDArray[np.single] = cython.declare(np.ndarray)  # type: ignore
@@ -69,6 +152,8 @@ class HSDetection(object):
     median_reference: bool = cython.declare(bool_t)  # type: ignore
     average_reference: bool = cython.declare(bool_t)  # type: ignore
 
+    init_data: Optional[NDArray[np.single]] = cython.declare(object)  # type: ignore
+
     spike_duration: int = cython.declare(int32_t)  # type: ignore
     amp_avg_duration: int = cython.declare(int32_t)  # type: ignore
     threshold: float = cython.declare(single)  # type: ignore
@@ -80,25 +165,46 @@ class HSDetection(object):
     inner_radius: float = cython.declare(single)  # type: ignore
 
     temporal_jitter: int = cython.declare(int32_t)  # type: ignore
+    sweep_configs: list[tuple[float, float, float, int]] = cython.declare(list)  # type: ignore
     rise_duration: int = cython.declare(int32_t)  # type: ignore
 
+    artifact_fraction: float = cython.declare(single)  # type: ignore
+
     decay_filtering: bool = cython.declare(bool_t)  # type: ignore
     decay_ratio: float = cython.declare(single)  # type: ignore
 
     localize: bool = cython.declare(bool_t)  # type: ignore
 
     save_shape: bool = cython.declare(bool_t)  # type: ignore
+    compress_shape: bool = cython.declare(bool_t)  # type: ignore
+    neighbor_shape: bool = cython.declare(bool_t)  # type: ignore
     shape_file: Optional[Path] = cython.declare(object)  # type: ignore
     cutout_start: int = cython.declare(int32_t)  # type: ignore
     cutout_end: int = cython.declare(int32_t)  # type: ignore
     cutout_length: int = cython.declare(int32_t)  # type: ignore
 
+    table_file: Optional[Path] = cython.declare(object)  # type: ignore
+
+    checkpoint_file: Optional[Path] = cython.declare(object)  # type: ignore
+    checkpoint_interval: float = cython.declare(cython.double)  # type: ignore
+
     verbose: bool = cython.declare(bool_t)  # type: ignore
 
-    @cython.locals(recording=object, params=object,
-                   fps=single, l=np.ndarray, m=np.ndarray, r=np.ndarray,
+    stream_det = cython.declare(p_det)  # type: ignore  # NULL if no stream open
+    stream_frame: int = cython.declare(int32_t)  # type: ignore
+    stream_emitted: list[int] = cython.declare(list)  # type: ignore  # of each config
+    stream_artifacts: int = cython.declare(int32_t)  # type: ignore  # intervals returned
+    stream_latency: float = cython.declare(cython.double, visibility='readonly')  # type: ignore
+    stream_segment: int = cython.declare(int32_t)  # type: ignore
+
+    stats: dict[int, dict[str, object]] = cython.declare(dict, visibility='readonly')  # type: ignore
+    footprint: dict[int, dict[str, object]] = cython.declare(dict, visibility='readonly')  # type: ignore
+
+    @cython.locals(recording=object, params=object, chunk_size=object, calibration=object,
+                   fps=single, mask=np.ndarray, l=np.ndarray, m=np.ndarray, r=np.ndarray,
                    common_reference=str, duration_float=single,
-                   positions=np.ndarray, shape_file=object)
+                   positions=np.ndarray, sweep=object, max_jitter=int32_t, config=tuple,
+                   shape_file=object, table_file=object, checkpoint_file=object)
     def __init__(self, recording: Recording, params: Params) -> None:
         self.recording = recording
         self.num_segments = recording.get_num_segments()
@@ -107,16 +213,38 @@ class HSDetection(object):
         fps = recording.get_sampling_frequency()
 
         self.num_channels = recording.get_num_channels()
-        self.chunk_size = params['chunk_size']
+        chunk_size = params['chunk_size']
+        self.auto_chunk = chunk_size == 'auto'
+        self.chunk_size = 0 if self.auto_chunk else chunk_size
+        self.memory_budget = params['memory_budget']
+
+        self.numa_aware = params['numa_aware']
+
+        calibration = None  # random data chunks, reused by auto chunk size
+
+        # channels left out of every stage, given or found on calibration
+        mask: NDArray[np.bool_] = np.zeros(self.num_channels, dtype=np.bool_)
+        if params['bad_channels'] is not None:
+            mask[np.asarray(list(params['bad_channels']), dtype=np.intp)] = True
+        if params['detect_bad_channels']:
+            calibration = self.get_random_data_chunks()
+            mask |= find_bad_channels(calibration)
+        assert not mask.all(), 'Expect some channels in use, got all masked'
+        self.channel_mask = mask if mask.any() else None
+        if params['verbose'] and self.channel_mask is not None:
+            print(f'HSDetection: Leaving out bad channels {np.flatnonzero(mask).tolist()}')
 
         self.rescale = params['rescale']
         if self.rescale:
-            l, m, r = np.quantile(self.get_random_data_chunks(),
+            if calibration is None:
+                calibration = self.get_random_data_chunks()
+            l, m, r = np.quantile(calibration,
                                   q=[0.05, 0.5, 1 - 0.05], axis=0)
             # quantile gives float64 on float32 data
             l: NDArray[np.single] = l.astype(np.single)
             m: NDArray[np.single] = m.astype(np.single)
             r: NDArray[np.single] = r.astype(np.single)
+            r[mask] = l[mask] + 1  # not used, only to avoid division by zero on dead channels
 
             self.scale: NDArray[np.single] = np.ascontiguousarray(
                 params['rescale_value'] / (r - l), dtype=np.single)
@@ -135,6 +263,14 @@ class HSDetection(object):
             warnings.warn(
                 f'Number of channels too few for common {common_reference} reference')
 
+        # about a second of frames spread over the calibration chunks, to seed the running estimation
+        self.init_data = None
+        if params['fast_init']:
+            if calibration is None:
+                calibration = self.get_random_data_chunks()
+            self.init_data = np.ascontiguousarray(
+                calibration[::max(1, calibration.shape[0] // int(fps))], dtype=np.single)
+
         duration_float = params['spike_duration']
         self.spike_duration = int(duration_float * fps / 1000 + 0.5)
         duration_float = params['amp_avg_duration']
@@ -163,19 +299,35 @@ class HSDetection(object):
         duration_float = params['rise_duration']
         self.rise_duration = int(duration_float * fps / 1000 + 0.5)
 
+        # more configs detected in the same pass, each overriding some of the main ones
+        self.sweep_configs = []
+        for sweep in params['sweep'] or []:
+            assert set(sweep) <= {'threshold', 'min_avg_amp', 'AHP_thr', 'peak_jitter'}, \
+                f'Expect sweep keys of threshold, min_avg_amp, AHP_thr, peak_jitter, got {list(sweep)}'
+            duration_float = sweep.get('peak_jitter', params['peak_jitter'])
+            self.sweep_configs.append((sweep.get('threshold', self.threshold),
+                                       sweep.get('min_avg_amp', self.min_avg_amp),
+                                       sweep.get('AHP_thr', self.max_AHP_amp),
+                                       int(duration_float * fps / 1000 + 0.5)))
+        max_jitter = max([self.temporal_jitter] + [config[3] for config in self.sweep_configs])
+
+        self.artifact_fraction = params['artifact_fraction']
+
         self.decay_filtering = params['decay_filtering']
         self.decay_ratio = params['decay_ratio']
 
         self.localize = params['localize']
 
         self.save_shape = params['save_shape']
+        self.compress_shape = params['compress_shape']
+        self.neighbor_shape = params['neighbor_shape']
         if self.save_shape:
             shape_file = params['out_file']
             if isinstance(shape_file, str):
                 shape_file = Path(shape_file)
             shape_file.parent.mkdir(parents=True, exist_ok=True)
-            if shape_file.suffix != '.bin':
-                shape_file = shape_file.with_suffix('.bin')
+            if shape_file.suffix != ('.hsz' if self.compress_shape else '.bin'):
+                shape_file = shape_file.with_suffix('.hsz' if self.compress_shape else '.bin')
             self.shape_file = shape_file
         else:
             self.shape_file = None
@@ -185,25 +337,118 @@ class HSDetection(object):
         self.cutout_end = int(duration_float * fps / 1000 + 0.5)
         self.cutout_length = self.cutout_start + 1 + self.cutout_end
 
-        self.left_margin = self.temporal_jitter + \
-            max(self.cutout_length, self.rise_duration + 1 + self.spike_duration)
+        table_file = params['table_file']
+        if table_file is not None:
+            table_file = Path(table_file).with_suffix('.hst')
+            table_file.parent.mkdir(parents=True, exist_ok=True)
+        self.table_file = table_file
+
+        # frames before each chunk kept in rolling arrays, for the largest jitter
+        self.history_len = historyLen(self.spike_duration, self.rise_duration, self.temporal_jitter,  # type: ignore
+                                      self.cutout_start, self.cutout_end, self.sweep_configs)
+
+        checkpoint_file = params['checkpoint_file']
+        self.checkpoint_file = None if checkpoint_file is None else Path(checkpoint_file)
+        self.checkpoint_interval = params['checkpoint_interval']
 
         self.verbose = params['verbose']
 
+        self.stats = {}
+        self.footprint = {}
+
         # sanity checks
         assert self.num_channels > 0, f'Expect number of channels >0, got {self.num_channels}'
-        assert self.chunk_size > 0, f'Expect chunk size >0, got {self.chunk_size}'
-        assert self.threshold > 0, f'Expect detection threshold >0, got {self.threshold}'
-        assert self.min_avg_amp > 0, f'Expect min avg amplitude >0, got {self.min_avg_amp}'
-        assert self.max_AHP_amp <= 0, f'Expect AHP threshold <=0, got {self.max_AHP_amp}'
+        assert self.auto_chunk or self.chunk_size > 0, f'Expect chunk size >0 or auto, got {chunk_size}'
+        for config in [(self.threshold, self.min_avg_amp, self.max_AHP_amp, self.temporal_jitter)] + \
+                self.sweep_configs:
+            assert config[0] > 0, f'Expect detection threshold >0, got {config[0]}'
+            assert config[1] > 0, f'Expect min avg amplitude >0, got {config[1]}'
+            assert config[2] <= 0, f'Expect AHP threshold <=0, got {config[2]}'
+            assert config[3] >= 0, f'Expect temporal jitter >=0, got {config[3]}'
+        assert 0 <= self.artifact_fraction <= 1, \
+            f'Expect artifact fraction within [0, 1], got {self.artifact_fraction}'
         assert self.neighbor_radius >= 0, f'Expect neighbor radius >=0, got {self.neighbor_radius}'
         assert self.inner_radius >= 0, f'Expect inner neighbor radius >=0, got {self.neighbor_radius}'
         assert 0 <= self.decay_ratio <= 1, f'Expect decay filtering ratio >=0,<=1, got {self.decay_ratio}'
-        assert self.temporal_jitter >= 0, f'Expect temporal jitter >=0, got {self.temporal_jitter}'
-        assert self.spike_duration >= self.temporal_jitter, f'Expect spike duration >=jitter={self.temporal_jitter}, got {self.spike_duration}'
-        assert self.rise_duration >= self.temporal_jitter, f'Expect rising duration >=jitter={self.temporal_jitter}, got {self.rise_duration}'
-        assert self.cutout_start >= self.temporal_jitter, f'Expect cutout start >=jitter={self.temporal_jitter}, got {self.cutout_start}'
-        assert self.cutout_end >= self.temporal_jitter, f'Expect cutout end >=jitter={self.temporal_jitter}, got {self.cutout_end}'
+        assert self.spike_duration >= max_jitter, f'Expect spike duration >=jitter={max_jitter}, got {self.spike_duration}'
+        assert self.rise_duration >= max_jitter, f'Expect rising duration >=jitter={max_jitter}, got {self.rise_duration}'
+        assert self.cutout_start >= max_jitter, f'Expect cutout start >=jitter={max_jitter}, got {self.cutout_start}'
+        assert self.cutout_end >= max_jitter, f'Expect cutout end >=jitter={max_jitter}, got {self.cutout_end}'
+
+        if self.auto_chunk:
+            self.select_chunk_size(self.get_random_data_chunks()
+                                   if calibration is None else calibration)
+        else:
+            self.chunk_length = self.chunk_size
+            self.chunk_candidates = [self.chunk_size]
+
+    @cython.cfunc
+    @cython.locals(data=np.ndarray, num_threads=int32_t, min_chunk=int32_t,
+                   channel_align=int32_t, rolling_bytes=cython.double, input_bytes=cython.double,
+                   k=int32_t, chunk=int32_t, probe=np.ndarray,
+                   elapsed=cython.double, best_time=cython.double)
+    @cython.returns(cython.void)
+    def select_chunk_size(self, data: NDArray[np.single]) -> None:
+        # rolling arrays of trace, baseline and deviation on channels aligned to 64B, and common reference
+        channel_align = 64 // VOLT_DTYPE.itemsize
+        rolling_bytes = ((self.num_channels + channel_align - 1) // channel_align * channel_align * 3 + 1) * \
+            VOLT_DTYPE.itemsize
+        # float32 input of a chunk, and the traces from recording before the cast
+        input_bytes = self.num_channels * 4 * 2
+
+        num_threads = omp_get_max_threads()  # type: ignore
+        min_chunk = max(num_threads * 1024, self.history_len)  # enough frames for each thread to cast
+
+        # rolling arrays are rounded up to 2^k frames, so only chunk sizes filling them exactly are tried
+        self.chunk_candidates = []
+        for k in range(10, 31):
+            chunk = (1 << k) - 1 - self.history_len
+            if chunk < min_chunk:
+                continue
+            if (1 << k) * rolling_bytes + chunk * input_bytes > self.memory_budget * 2**20:
+                break
+            self.chunk_candidates.append(chunk)
+        assert self.chunk_candidates, \
+            f'Memory budget {self.memory_budget}MiB too small for {self.num_channels} channels'
+        self.chunk_size = self.chunk_candidates[-1]  # allocate for the largest, steps can be shorter
+
+        probe = np.ascontiguousarray(data, dtype=np.single)
+        self.chunk_length = self.chunk_candidates[0]
+        best_time = float('inf')
+        for chunk in self.chunk_candidates:
+            if chunk * 2 > data.shape[0]:  # at least two steps in probe
+                break
+            elapsed = self.time_probe(probe, chunk)
+            if elapsed < best_time:
+                best_time = elapsed
+                self.chunk_length = chunk
+
+        if self.verbose:
+            print(f'HSDetection: Auto chunk size {self.chunk_size}, '
+                  f'starting with chunk length {self.chunk_length}')
+
+    @cython.cfunc
+    @cython.locals(probe=np.ndarray, chunk_size=int32_t,
+                   num_frames=int32_t, chunk_start=int32_t, chunk_len=int32_t,
+                   start_time=cython.double, elapsed=cython.double)
+    @cython.returns(cython.double)
+    def time_probe(self, probe: NDArray[np.single], chunk_size: int) -> float:
+        det = self.new_detection(chunk_size, False, None, None)
+
+        num_frames = probe.shape[0]
+        start_time = perf_counter()
+        chunk_start = 0
+        while chunk_start < num_frames:
+            chunk_len = min(chunk_size, num_frames - chunk_start)
+            det.step(cython.cast(p_single, probe.data) + chunk_start * self.num_channels,
+                     chunk_start, chunk_len)
+            chunk_start += chunk_len
+        det.finish()
+        elapsed = perf_counter() - start_time
+
+        delDet(det)  # type: ignore
+
+        return elapsed
 
     @cython.cfunc
     @cython.locals(chunks_per_seg=int32_t, chunk_size=int32_t, seed=object,
@@ -230,56 +475,36 @@ class HSDetection(object):
         return np.concatenate(chunks, axis=0, dtype=np.float32)
 
     @cython.cfunc
-    @cython.locals(segment_index=int32_t, start_frame=int32_t, end_frame=int32_t,
-                   pad_left=int32_t, pad_right=int32_t,
-                   traces=np.ndarray, traces_float=np.ndarray)
-    @cython.returns(np.ndarray)
-    def get_traces(self, segment_index: int, start_frame: int, end_frame: int) -> NDArray[np.single]:
-        if start_frame < 0:
-            pad_left = -start_frame * self.num_channels
-            start_frame = 0
-        else:
-            pad_left = 0
-        if end_frame > self.num_frames[segment_index]:
-            pad_right = (end_frame - self.num_frames[segment_index]
-                         ) * self.num_channels
-            end_frame = self.num_frames[segment_index]
-        else:
-            pad_right = 0
-
-        traces: RealArray = self.recording.get_traces(
-            segment_index=segment_index, start_frame=start_frame, end_frame=end_frame)
-
-        traces_float: NDArray[np.single] = traces.astype(
-            np.single, copy=False).reshape(-1)  # type: ignore # force cast to single
-
-        if pad_left or pad_right:
-            traces_float = np.pad(traces_float, (pad_left, pad_right),
-                                  mode='constant', constant_values=0)
-
-        return traces_float
-
-    @cython.ccall
-    @cython.returns(list)
-    def detect(self) -> list[dict[str, RealArray]]:
-        return [self.detect_seg(seg) for seg in range(self.num_segments)]
+    @cython.locals(det=p_det, traces=object, chunk_start=int32_t,
+                   chunk_len=int32_t, traces_single=np.ndarray)
+    @cython.returns(cython.void)
+    def step_traces(self, det: p_det, traces: RealArray, chunk_start: int) -> None:  # type: ignore
+        # only the frames of the chunk are needed, the history is kept in Detection
+        chunk_len = traces.shape[0]
+        if traces.dtype == np.single and traces.flags.c_contiguous:
+            traces_single = traces  # used in place
+            det.step(cython.cast(p_single, traces_single.data), chunk_start, chunk_len)
+        else:  # cast into the input buffer owned by Detection, without intermediate copy
+            np.copyto(np.asarray(inputView(det, chunk_len, self.num_channels)),  # type: ignore
+                      traces, casting='unsafe')
+            det.stepInput(chunk_start, chunk_len)
 
     @cython.cfunc
-    @cython.locals(segment_index=int32_t,
-                   trace=np.ndarray, shape_file=object,
-                   num_frames=int32_t, chunk_start=int32_t, chunk_len=int32_t,
-                   sample_ind=np.ndarray, channel_ind=np.ndarray,
-                   amplitude=np.ndarray, location=np.ndarray,
-                   spikes=np.ndarray, result=dict)
-    @cython.returns(dict)
-    def detect_seg(self, segment_index: int) -> dict[str, RealArray]:
-        shape_file = None if self.shape_file is None \
-            else self.shape_file.with_stem(f'{self.shape_file.stem}-{segment_index}')
+    @cython.locals(chunk_size=int32_t, save_shape=bool_t, shape_file=object, table_file=object,
+                   channel_mask=np.ndarray, mask_data=p_bool)
+    @cython.returns(p_det)  # type: ignore
+    def new_detection(self, chunk_size: int, save_shape: bool, shape_file: Optional[Path],
+                      table_file: Optional[Path]):
+        channel_mask = self.channel_mask  # typed for the pointer, NULL if all channels in use
+        mask_data = cython.NULL
+        if channel_mask is not None:
+            mask_data = cython.cast(p_bool, channel_mask.data)
 
-        det = newDet(  # type: ignore
+        return newDet(  # type: ignore
             self.num_channels,
-            self.chunk_size,
-            self.left_margin,
+            chunk_size,
+            0,  # chunks are passed without left margin
+            self.numa_aware,
             self.rescale,
             cython.cast(p_single, self.scale.data),
             cython.cast(p_single, self.offset.data),
@@ -298,15 +523,119 @@ class HSDetection(object):
             self.decay_filtering,
             self.decay_ratio,
             self.localize,
-            self.save_shape,
+            save_shape,
             str(shape_file).encode(),
             self.cutout_start,
-            self.cutout_end
+            self.cutout_end,
+            self.compress_shape,
+            self.neighbor_shape,
+            mask_data,
+            self.sweep_configs,
+            b'' if table_file is None else str(table_file).encode(),
+            self.artifact_fraction
         )
 
-        num_frames = self.num_frames[segment_index]
+    @cython.cfunc
+    @cython.locals(det=p_det, init_data=np.ndarray)
+    @cython.returns(cython.void)
+    def init_estimation(self, det: p_det) -> None:  # type: ignore
+        if self.init_data is None:
+            return  # converge from the constant initial values instead
+
+        init_data = self.init_data
+        det.initEstimation(cython.cast(p_single, init_data.data), init_data.shape[0])
+
+    @cython.ccall
+    @cython.returns(list)
+    def detect(self) -> list[dict[str, RealArray]]:
+        return [self.detect_seg(seg, cython.NULL, 0, -1) for seg in range(self.num_segments)]
+
+    @cython.ccall
+    @cython.locals(file_path=object, dtype=object, offset=cython.longlong,
+                   segment_index=int32_t, reader=p_reader, result=dict)
+    @cython.returns(dict)
+    def detect_file(self,
+                    file_path: Union[str, Path],
+                    dtype: Union[str, np.dtype] = 'int16',
+                    offset: int = 0,
+                    segment_index: int = 0
+                    ) -> dict[str, RealArray]:
+        """Detect on the data file of a segment read natively, bypassing \
+        `get_traces` of the recording, which still provides the probe and \
+        calibration. MDA files (`.mda`) are read with their header, and other \
+        files as flat binary of interleaved `dtype` samples after `offset` bytes \
+        (e.g. the offset of a contiguous dataset in NWB/HDF5).
+        """
+        file_path = Path(file_path)
+        if file_path.suffix == '.mda':
+            reader = newMdaReader(str(file_path).encode())  # type: ignore
+        else:
+            reader = newBinaryReader(str(file_path).encode(), self.num_channels,  # type: ignore
+                                     np.dtype(dtype).name.encode(), offset)
+        try:
+            assert reader.getNumChannels() == self.num_channels, \
+                f'Expect {self.num_channels} channels in file, got {reader.getNumChannels()}'
+            result = self.detect_seg(segment_index, reader, 0, -1)
+        finally:
+            delReader(reader)  # type: ignore
+
+        return result
+
+    @cython.ccall
+    @cython.locals(segment_index=int32_t, start_frame=int32_t, end_frame=int32_t)
+    @cython.returns(dict)
+    def detect_range(self, segment_index: int, start_frame: int, end_frame: int) -> dict[str, RealArray]:
+        """Detect on the frames `[start_frame, end_frame)` of a segment as \
+        if they were the whole segment (e.g. a time shard), with `sample_ind` \
+        still counted from the start of the segment.
+        """
+        assert 0 <= start_frame < end_frame <= self.num_frames[segment_index], \
+            f'Expect frames within [0, {self.num_frames[segment_index]}], got [{start_frame}, {end_frame})'
+
+        return self.detect_seg(segment_index, cython.NULL, start_frame, end_frame)
+
+    @cython.cfunc
+    @cython.locals(segment_index=int32_t, reader=p_reader, start_frame=int32_t, end_frame=int32_t,
+                   shape_file=object, shape_channels=int32_t, table_file=object,
+                   checkpoint=object, checkpoint_time=cython.double,
+                   num_frames=int32_t, chunk_start=int32_t, chunk_len=int32_t,
+                   step_dir=int32_t, cand_idx=int32_t, start_time=cython.double,
+                   speed=cython.double, prev_speed=cython.double,
+                   result=dict, sweep_results=list, config=int32_t, artifacts=object)
+    @cython.returns(dict)
+    def detect_seg(self, segment_index: int, reader: p_reader,  # type: ignore
+                   start_frame: int, end_frame: int) -> dict[str, RealArray]:
+        shape_file = None if self.shape_file is None \
+            else self.shape_file.with_stem(f'{self.shape_file.stem}-{segment_index}')
+        table_file = None if self.table_file is None \
+            else self.table_file.with_stem(f'{self.table_file.stem}-{segment_index}')
+
+        det = self.new_detection(self.chunk_size, self.save_shape, shape_file, table_file)
+
+        # native reader if given, otherwise get_traces of recording, on frames from start_frame (to the end if -1)
+        num_frames = self.num_frames[segment_index] if reader == cython.NULL else reader.getNumFrames()
+        if end_frame >= 0:
+            num_frames = end_frame - start_frame
         chunk_start = 0
-        chunk_len = min(self.chunk_size, num_frames)
+
+        # resume from the snapshot left by an interrupted run of the same params
+        checkpoint = None if self.checkpoint_file is None \
+            else self.checkpoint_file.with_stem(f'{self.checkpoint_file.stem}-{segment_index}')
+        if checkpoint is not None and checkpoint.exists():
+            det.loadState(str(checkpoint).encode())
+            chunk_start = det.getNextFrame()
+            if self.verbose:
+                print(f'HSDetection: Resuming segment {segment_index} from frame {chunk_start} of {checkpoint}')
+        else:
+            self.init_estimation(det)
+        checkpoint_time = perf_counter()
+
+        chunk_len = min(self.chunk_length, num_frames)
+        # hill climbing of chunk length on throughput, only for auto chunk size
+        cand_idx = self.chunk_candidates.index(self.chunk_length)
+        step_dir = 0 if not self.auto_chunk else \
+            1 if cand_idx + 1 < len(self.chunk_candidates) else -1
+        prev_speed = 0
         while chunk_start < num_frames:
             chunk_len = min(chunk_len, num_frames - chunk_start)
 
@@ -315,42 +644,421 @@ class HSDetection(object):
                       f'frames from {chunk_start:8d} to {chunk_start + chunk_len:8d} '
                       f' ({100 * chunk_start / num_frames:.1f}%)')
 
-            trace = self.get_traces(segment_index=segment_index,
-                                    start_frame=chunk_start - self.left_margin,
-                                    end_frame=chunk_start + chunk_len)
-            det.step(cython.cast(p_single, trace.data), chunk_start, chunk_len)
+            start_time = perf_counter()
+            if reader == cython.NULL:
+                self.step_traces(det, self.recording.get_traces(segment_index=segment_index,
+                                                                start_frame=start_frame + chunk_start,
+                                                                end_frame=start_frame + chunk_start + chunk_len),
+                                 chunk_start)
+            else:
+                det.stepFrom(reader[0], chunk_start, chunk_len)
+
+            if table_file is not None:  # in the table already, memory bounded by a chunk of spikes
+                det.discardResult()
 
             chunk_start += chunk_len
 
-        det_len = det.finish()
-        det_result = det.getResult()
+            if checkpoint is not None and chunk_start < num_frames and \
+                    perf_counter() - checkpoint_time >= self.checkpoint_interval:
+                save_checkpoint(det, checkpoint)
+                checkpoint_time = perf_counter()
 
-        sample_ind = np.empty(det_len, dtype=np.int32)
-        channel_ind = np.empty(det_len, dtype=np.int32)
-        amplitude = np.empty(det_len, dtype=np.int16)
-        location = np.empty((det_len, 2), dtype=np.single)
-        for i in range(det_len):
-            sample_ind[i] = det_result[i].frame
-            channel_ind[i] = det_result[i].channel
-            amplitude[i] = det_result[i].amplitude
-            location[i, 0] = det_result[i].position.x
-            location[i, 1] = det_result[i].position.y
+            if step_dir != 0:
+                speed = chunk_len / (perf_counter() - start_time)
+                if speed < prev_speed:  # worse than the previous length, go back and settle
+                    cand_idx -= step_dir
+                    step_dir = 0
+                else:
+                    prev_speed = speed
+                    if 0 <= cand_idx + step_dir < len(self.chunk_candidates):
+                        cand_idx += step_dir
+                    else:
+                        step_dir = 0
+                chunk_len = self.chunk_candidates[cand_idx]
+
+        det.finish()
+        if table_file is None:  # otherwise read back from the table once closed
+            result = self.collect_result(det, 0, 0, det.getNumResult(0))
+            sweep_results = [self.collect_result(det, config, 0, det.getNumResult(config))
+                             for config in range(1, det.getNumConfigs())]
+        artifacts = None if self.artifact_fraction == 0 \
+            else self.collect_artifacts(det, 0, det.getNumArtifacts())
+        self.collect_stats(det, segment_index)
+        self.collect_footprint(det, segment_index)
+        shape_channels = det.getShapeChannels()
 
         delDet(det)  # type: ignore
 
-        if shape_file is not None and shape_file.stat().st_size > 0:
+        if checkpoint is not None:  # segment done, not to be resumed
+            checkpoint.unlink(missing_ok=True)
+
+        if table_file is not None:  # the last block and the index are written on close
+            result = SpikeTable(table_file).columns()
+            sweep_results = [SpikeTable(sweep_file(table_file, config)).columns()
+                             for config in range(1, len(self.sweep_configs) + 1)]
+
+        result['sample_ind'] += start_frame
+        self.load_shapes(result, shape_file, shape_channels)
+        for config in range(1, len(sweep_results) + 1):
+            sweep_results[config - 1]['sample_ind'] += start_frame
+            self.load_shapes(sweep_results[config - 1],
+                             None if shape_file is None else sweep_file(shape_file, config), shape_channels)
+        if self.sweep_configs:
+            result['sweep'] = sweep_results
+        if artifacts is not None:
+            result['artifacts'] = artifacts + start_frame
+
+        return result
+
+    @cython.cfunc
+    @cython.locals(result=dict, shape_file=object, shape_channels=int32_t, shape_dims=tuple,
+                   channel_file=object, spikes=object)
+    @cython.returns(cython.void)
+    def load_shapes(self, result: dict[str, RealArray], shape_file: Optional[Path], shape_channels: int) -> None:
+        # cutouts of frames x neighbor channels, padded to the largest neighborhood
+        shape_dims = (self.cutout_length,)
+        if self.neighbor_shape:
+            shape_dims = (self.cutout_length, shape_channels)
+        if shape_file is not None and self.compress_shape:
+            spikes = CompressedShapes(shape_file)
+        elif shape_file is not None and shape_file.stat().st_size > 0:
             spikes: NDArray[np.int16] = np.memmap(
-                str(shape_file), dtype=np.int16, mode='r').reshape(-1, self.cutout_length)
+                str(shape_file), dtype=VOLT_DTYPE, mode='r').reshape(-1, *shape_dims)
         else:
             spikes: NDArray[np.int16] = np.empty(
-                (0, self.cutout_length), dtype=np.int16)
+                (0, *shape_dims), dtype=VOLT_DTYPE)
+
+        if self.save_shape:
+            result['spike_shape'] = spikes
+
+        # channels of each cutout, -1 for padding
+        if self.save_shape and self.neighbor_shape:
+            channel_file = shape_file.with_suffix('.channels.bin')
+            result['spike_channels'] = np.memmap(
+                str(channel_file), dtype=np.int32, mode='r').reshape(-1, shape_channels) \
+                if channel_file.stat().st_size > 0 else np.empty((0, shape_channels), dtype=np.int32)
+
+    @cython.cfunc
+    @cython.locals(det=p_det, config=int32_t, start=int32_t, stop=int32_t, i=int32_t,
+                   sample_ind=np.ndarray, channel_ind=np.ndarray,
+                   amplitude=np.ndarray, location=np.ndarray, result=dict)
+    @cython.returns(dict)
+    def collect_result(self, det: p_det, config: int,  # type: ignore
+                       start: int, stop: int) -> dict[str, RealArray]:
+        det_result = det.getResult(config)
+
+        sample_ind = np.empty(stop - start, dtype=np.int32)
+        channel_ind = np.empty(stop - start, dtype=np.int32)
+        amplitude = np.empty(stop - start, dtype=VOLT_DTYPE)
+        location = np.empty((stop - start, 2), dtype=np.single)
+        for i in range(start, stop):
+            sample_ind[i - start] = det_result[i].frame
+            channel_ind[i - start] = det_result[i].channel
+            amplitude[i - start] = det_result[i].amplitude
+            location[i - start, 0] = det_result[i].position.x
+            location[i - start, 1] = det_result[i].position.y
 
         result: dict[str, RealArray] = {'sample_ind': sample_ind,
                                         'channel_ind': channel_ind,
                                         'amplitude': amplitude}
         if self.localize:
             result['location'] = location
-        if self.save_shape:
-            result['spike_shape'] = spikes
 
         return result
+
+    @cython.cfunc
+    @cython.locals(det=p_det, start=int32_t, stop=int32_t, i=int32_t, artifacts=np.ndarray)
+    @cython.returns(np.ndarray)
+    def collect_artifacts(self, det: p_det, start: int, stop: int) -> NDArray[np.int32]:  # type: ignore
+        det_artifacts = det.getArtifacts()
+
+        artifacts = np.empty((stop - start, 2), dtype=np.int32)
+        for i in range(start, stop):
+            artifacts[i - start, 0] = det_artifacts[i * 2]
+            artifacts[i - start, 1] = det_artifacts[i * 2 + 1]
+
+        return artifacts
+
+    @cython.cfunc
+    @cython.locals(det=p_det, segment_index=int32_t, stats=DetectionStats,
+                   i=cython.size_t, busy=list, per_spike=cython.double)
+    @cython.returns(cython.void)
+    def collect_stats(self, det: p_det, segment_index: int) -> None:  # type: ignore
+        if not collectStats:  # type: ignore
+            return
+
+        stats = det.getStats()
+
+        busy = [stats.threads[i].castTime + stats.threads[i].estimateTime
+                for i in range(stats.threads.size())]
+        per_spike = 1 / stats.numEmitted if stats.numEmitted > 0 else 0
+        self.stats[segment_index] = {
+            'steps': stats.numSteps,
+            'frames': stats.numFrames,
+            'step_time': stats.stepTime,
+            'cast_time': [stats.threads[i].castTime for i in range(stats.threads.size())],
+            'estimate_time': [stats.threads[i].estimateTime for i in range(stats.threads.size())],
+            'wait_time': [stats.threads[i].waitTime for i in range(stats.threads.size())],
+            'load_imbalance': max(busy) / (sum(busy) / len(busy)) if sum(busy) > 0 else 1.0,
+            'queue_time': stats.queueTime,
+            'detected': stats.numDetected,
+            'emitted': stats.numEmitted,
+            'peak_queue_len': stats.peakQueueLen,
+            'per_spike_time': {'finder': stats.finderTime * per_spike,
+                               'filter': stats.filterTime * per_spike,
+                               'localize': stats.localizeTime * per_spike,
+                               'shape': stats.shapeTime * per_spike},
+            'shape_bytes': stats.shapeBytes,
+            'blanked_frames': stats.numBlanked
+        }
+
+    @cython.cfunc
+    @cython.locals(det=p_det, segment_index=int32_t)
+    @cython.returns(cython.void)
+    def collect_footprint(self, det: p_det, segment_index: int) -> None:  # type: ignore
+        self.footprint[segment_index] = {
+            'bytes': det.getFootprint(),
+            'pages': det.getPageKind().decode()
+        }
+        if self.verbose:
+            print(f'HSDetection: Buffers of segment {segment_index} in {det.getFootprint() / 2**20:.1f} MiB '
+                  f'of {det.getPageKind().decode()} pages')
+
+    @cython.ccall
+    @cython.locals(segment_index=int32_t, resume_file=object, shape_file=object, table_file=object)
+    @cython.returns(cython.void)
+    def open_stream(self, segment_index: int = 0, resume_file: Union[str, Path, None] = None) -> None:
+        """Open a stream, or resume the one saved by `save_stream()`. After \
+        resuming, `push()` continues from the next frame of the saved stream, \
+        and the spikes emitted before saving are not returned again.
+        """
+        assert self.stream_det == cython.NULL, 'Stream already open'  # type: ignore
+
+        shape_file = None if self.shape_file is None \
+            else self.shape_file.with_stem(f'{self.shape_file.stem}-{segment_index}')
+        table_file = None if self.table_file is None \
+            else self.table_file.with_stem(f'{self.table_file.stem}-{segment_index}')
+
+        self.stream_det = self.new_detection(self.chunk_size, self.save_shape, shape_file, table_file)
+        self.stream_frame = 0
+        self.stream_emitted = [0] * (1 + len(self.sweep_configs))
+        self.stream_artifacts = 0
+        self.stream_latency = 0
+        self.stream_segment = segment_index
+
+        if resume_file is not None:
+            self.stream_det.loadState(str(resume_file).encode())
+            self.stream_frame = self.stream_det.getNextFrame()
+            self.stream_emitted = [self.stream_det.getNumResult(config)
+                                   for config in range(self.stream_det.getNumConfigs())]
+            self.stream_artifacts = self.stream_det.getNumArtifacts()
+        else:
+            self.init_estimation(self.stream_det)
+
+    @cython.ccall
+    @cython.locals(save_file=object)
+    @cython.returns(cython.void)
+    def save_stream(self, save_file: Union[str, Path]) -> None:
+        """Save the state of the open stream between `push()` calls."""
+        assert self.stream_det != cython.NULL, 'Stream not open'  # type: ignore
+
+        save_checkpoint(self.stream_det, Path(save_file))
+
+    @cython.ccall
+    @cython.locals(traces=object, num_frames=int32_t, block_start=int32_t, block_len=int32_t)
+    @cython.returns(dict)
+    def push(self, traces: RealArray) -> dict[str, RealArray]:
+        assert self.stream_det != cython.NULL, 'Stream not open'  # type: ignore
+        assert traces.ndim == 2 and traces.shape[1] == self.num_channels, \
+            f'Expect block of shape (n, {self.num_channels}), got {np.shape(traces)}'
+
+        num_frames = traces.shape[0]
+
+        self.stream_latency = 0
+        block_start = 0
+        while block_start < num_frames:  # split if longer than allocated for
+            block_len = min(self.chunk_size, num_frames - block_start)
+            self.step_traces(self.stream_det, traces[block_start:block_start + block_len], self.stream_frame)
+            self.stream_latency += self.stream_det.getStepLatency()
+            self.stream_frame += block_len
+            block_start += block_len
+
+        return self.collect_stream()
+
+    @cython.ccall
+    @cython.locals(result=dict)
+    @cython.returns(dict)
+    def close_stream(self) -> dict[str, RealArray]:
+        assert self.stream_det != cython.NULL, 'Stream not open'  # type: ignore
+
+        self.stream_det.finish()
+        result = self.collect_stream()
+        self.collect_stats(self.stream_det, self.stream_segment)
+        self.collect_footprint(self.stream_det, self.stream_segment)
+
+        delDet(self.stream_det)  # type: ignore
+        self.stream_det = cython.NULL
+
+        return result
+
+    @cython.cfunc
+    @cython.locals(config=int32_t, num_result=int32_t, num_artifacts=int32_t, results=list, result=dict)
+    @cython.returns(dict)
+    def collect_stream(self) -> dict[str, RealArray]:
+        # spikes emitted since the last call, of the main config and the sweep, and artifacts closed since then
+        results = []
+        for config in range(self.stream_det.getNumConfigs()):
+            num_result = self.stream_det.getNumResult(config)
+            results.append(self.collect_result(self.stream_det, config, self.stream_emitted[config], num_result))
+            self.stream_emitted[config] = num_result
+
+        if self.table_file is not None:  # in the table already, memory bounded by a block of spikes
+            self.stream_det.discardResult()
+            self.stream_emitted = [0] * len(results)
+
+        result = results[0]
+        if self.sweep_configs:
+            result['sweep'] = results[1:]
+        if self.artifact_fraction > 0:
+            num_artifacts = self.stream_det.getNumArtifacts()
+            result['artifacts'] = self.collect_artifacts(self.stream_det, self.stream_artifacts, num_artifacts)
+            self.stream_artifacts = num_artifacts
+        return result
+
+    def __dealloc__(self) -> None:
+        if self.stream_det != cython.NULL:  # type: ignore
+            delDet(self.stream_det)  # type: ignore
+
+
+@cython.ccall
+@cython.locals(data=np.ndarray, l=np.ndarray, r=np.ndarray, spread=np.ndarray, median=cython.double)
+@cython.returns(np.ndarray)
+def find_bad_channels(data: RealArray) -> NDArray[np.bool_]:
+    """Find dead (flat) and saturated or noisy channels in frames x channels \
+    of data, by the spread between 5% and 95% quantiles relative to the median \
+    spread of all channels.
+    """
+    l, r = np.quantile(data, q=[0.05, 1 - 0.05], axis=0)
+    spread = r - l
+    median = np.median(spread)
+    return (spread <= median * BAD_SPREAD_LOW) | (spread >= median * BAD_SPREAD_HIGH)
+
+
+@cython.ccall
+@cython.locals(num_threads=int32_t)
+@cython.returns(cython.void)
+def set_num_threads(num_threads: int) -> None:
+    """Set the team size of the `HSDetection` created afterwards in this \
+    process, e.g. to share the cores among worker processes.
+    """
+    omp_set_num_threads(num_threads)  # type: ignore
+
+
+@cython.cfunc
+@cython.locals(det=p_det, checkpoint=object, partial=object)
+@cython.returns(cython.void)
+def save_checkpoint(det: p_det, checkpoint: Path) -> None:  # type: ignore
+    # replaced as a whole, so an interrupted save keeps the previous snapshot
+    partial = checkpoint.with_name(checkpoint.name + '.partial')
+    det.saveState(str(partial).encode())
+    os.replace(partial, checkpoint)
+
+
+@cython.cfunc
+@cython.locals(output_file=object, config=int32_t)
+@cython.returns(object)
+def sweep_file(output_file: Path, config: int) -> Path:
+    # same as getSweepFilename in Detection, beside the shape or table file of the main config
+    return output_file.with_suffix(f'.sweep{config}{output_file.suffix}')
+
+
+@cython.cclass
+class CompressedShapes(object):
+    """Spike shapes in the compressed format (`compress_shape`), read by blocks on \
+    indexing. Supports `len`, indexing by int, slice, int array or bool mask along \
+    spikes, and conversion by `np.asarray`, like the memmap of the raw format. \
+    Neighborhood cutouts (`neighbor_shape`) have the channel axis after frames.
+    """
+
+    reader = cython.declare(p_shape_reader)  # type: ignore
+    num_spikes: int = cython.declare(cython.longlong, visibility='readonly')  # type: ignore
+    cutout_length: int = cython.declare(int32_t, visibility='readonly')  # type: ignore
+    num_channels: int = cython.declare(int32_t, visibility='readonly')  # type: ignore  # 0 if no channel axis
+
+    def __init__(self, shape_file: Union[str, Path]) -> None:
+        self.reader = newShapeReader(str(shape_file).encode())  # type: ignore
+        self.num_spikes = self.reader.getNumSpikes()
+        self.cutout_length = self.reader.getCutoutLen()
+        self.num_channels = self.reader.getNumChannels()
+
+    @property
+    def cutout_shape(self) -> tuple[int, ...]:
+        if self.num_channels > 0:
+            return (self.cutout_length, self.num_channels)
+        return (self.cutout_length,)
+
+    @property
+    def shape(self) -> tuple[int, ...]:
+        return (self.num_spikes, *self.cutout_shape)
+
+    @property
+    def dtype(self) -> np.dtype:
+        return VOLT_DTYPE
+
+    def __len__(self) -> int:
+        return self.num_spikes
+
+    @cython.ccall
+    @cython.locals(start=cython.longlong, count=cython.longlong, shapes=np.ndarray)
+    @cython.returns(np.ndarray)
+    def read(self, start: int, count: int) -> NDArray:
+        """Decode shapes [start, start+count) into a new array."""
+        shapes = np.empty((count, *self.cutout_shape), dtype=VOLT_DTYPE)
+        readShapes(self.reader, start, count, shapes)  # type: ignore
+        return shapes
+
+    @cython.locals(start=cython.longlong, stop=cython.longlong, step=cython.longlong,
+                   indices=np.ndarray, shapes=np.ndarray, i=cython.longlong)
+    def __getitem__(self, key) -> NDArray:
+        if isinstance(key, tuple):  # spikes first, then samples
+            return self[key[0]][key[1:]] if len(key) > 1 else self[key[0]]
+
+        if isinstance(key, slice):
+            start, stop, step = key.indices(self.num_spikes)
+            if step == 1:
+                return self.read(start, max(stop - start, 0))
+            indices = np.arange(start, stop, step)  # only the spikes taken
+        elif np.ndim(key) == 0:
+            index = operator.index(key)  # python int, so no overflow before the bounds check
+            if index < 0:
+                index += self.num_spikes
+            if index < 0 or index >= self.num_spikes:
+                raise IndexError(f'index {key} is out of bounds for axis 0 with size {self.num_spikes}')
+            return self.read(index, 1)[0]
+        else:
+            indices = np.asarray(key)
+            if indices.dtype == np.bool_:
+                if np.shape(indices) != (self.num_spikes,):
+                    raise IndexError(f'boolean index of shape {np.shape(indices)} does not match '
+                                     f'{self.num_spikes} spikes')
+                indices = np.flatnonzero(indices)
+            elif np.size(indices) == 0:
+                indices = indices.astype(np.intp)  # e.g. [] is float
+            elif not np.issubdtype(indices.dtype, np.integer):
+                raise IndexError('only integers, slices, integer or boolean arrays are valid indices')
+            if np.any((indices < -self.num_spikes) | (indices >= self.num_spikes)):
+                raise IndexError(f'index out of bounds for axis 0 with size {self.num_spikes}')
+            indices = np.where(indices < 0, indices + self.num_spikes, indices)
+
+        shapes = np.empty((np.size(indices), *self.cutout_shape), dtype=VOLT_DTYPE)
+        for i, index in enumerate(indices.flat):  # neighbouring indices hit the block decoded last
+            readShapes(self.reader, index, 1, shapes[i])  # type: ignore
+        return shapes.reshape(*np.shape(indices), *self.cutout_shape)
+
+    def __array__(self, dtype=None) -> NDArray:
+        shapes = self.read(0, self.num_spikes)
+        return shapes if dtype is None else shapes.astype(dtype, copy=False)
+
+    def __dealloc__(self) -> None:
+        if self.reader != cython.NULL:  # type: ignore
+            delShapeReader(self.reader)  # type: ignore
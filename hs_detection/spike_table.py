@@ -0,0 +1,81 @@
+from pathlib import Path
+from typing import Dict, List, Union
+
+import numpy as np
+from numpy.typing import NDArray
+
+__all__ = ['SpikeTable']
+
+# layout of SpikeTable.h, all little endian
+_HEADER = np.dtype([('magic', 'S8'), ('sample_bytes', '<u4'), ('is_float', '<u4'),
+                    ('block_spikes', '<u4'), ('has_location', '<u4'), ('reserved', 'V40')])
+_BLOCK_ENTRY = np.dtype([('offset', '<u8'), ('num_spikes', '<u4'), ('frame_start', '<i4'),
+                         ('frame_end', '<i4'), ('reserved', '<u4')])
+_FOOTER = np.dtype([('num_spikes', '<u8'), ('num_blocks', '<u8'), ('index_offset', '<u8'), ('magic', 'S8')])
+_COLUMN_ALIGN = 64
+
+
+class SpikeTable(object):
+    """The columnar spike table written with `table_file`, memory-mapped \
+    without parsing the blocks. `read(frame_start, frame_end)` gives the \
+    columns of the spikes within a frame range by the index of blocks, \
+    touching only those blocks, and `columns()` gives the whole table.
+    """
+
+    def __init__(self, table_file: Union[str, Path]) -> None:
+        self.table_file = Path(table_file)
+        self.data = np.memmap(self.table_file, dtype=np.uint8, mode='r')
+
+        header = self.data[:_HEADER.itemsize].view(_HEADER)[0]
+        footer = self.data[-_FOOTER.itemsize:].view(_FOOTER)[0]
+        assert header['magic'] == b'HSTABLE1' and footer['magic'] == b'HSTINDX1', \
+            f'Expect a complete spike table, got {self.table_file}'
+
+        sample_bytes = int(header['sample_bytes'])
+        self.amplitude_dtype = np.dtype(f'<f{sample_bytes}' if header['is_float'] else f'<i{sample_bytes}')
+        self.has_location = bool(header['has_location'])
+        self.num_spikes = int(footer['num_spikes'])
+
+        index_start = int(footer['index_offset'])
+        self.index: NDArray = self.data[index_start:index_start + int(footer['num_blocks']) * _BLOCK_ENTRY.itemsize] \
+            .view(_BLOCK_ENTRY)
+
+    def __len__(self) -> int:
+        return self.num_spikes
+
+    def block(self, i: int) -> Dict[str, NDArray]:
+        """Views of the columns of block `i`, without copy."""
+        offset, n = int(self.index[i]['offset']), int(self.index[i]['num_spikes'])
+        columns: Dict[str, NDArray] = {}
+        for key, dtype, width in [('sample_ind', np.dtype('<i4'), 1), ('channel_ind', np.dtype('<i4'), 1),
+                                  ('amplitude', self.amplitude_dtype, 1), ('location', np.dtype('<f4'), 2)]:
+            if key == 'location' and not self.has_location:
+                break
+            nbytes = n * width * dtype.itemsize
+            column = self.data[offset:offset + nbytes].view(dtype)
+            columns[key] = column.reshape(n, 2) if width == 2 else column
+            offset += (nbytes + _COLUMN_ALIGN - 1) // _COLUMN_ALIGN * _COLUMN_ALIGN
+        return columns
+
+    def _concat(self, blocks: List[Dict[str, NDArray]]) -> Dict[str, NDArray]:
+        if not blocks:
+            empty = {'sample_ind': np.empty(0, dtype=np.int32), 'channel_ind': np.empty(0, dtype=np.int32),
+                     'amplitude': np.empty(0, dtype=self.amplitude_dtype)}
+            if self.has_location:
+                empty['location'] = np.empty((0, 2), dtype=np.single)
+            return empty
+        return {key: np.concatenate([block[key] for block in blocks]) for key in blocks[0]}
+
+    def columns(self) -> Dict[str, NDArray]:
+        """All spikes in the order of emission, as the result of `detect()`."""
+        return self._concat([self.block(i) for i in range(len(self.index))])
+
+    def read(self, frame_start: int, frame_end: int) -> Dict[str, NDArray]:
+        """Spikes with frames in `[frame_start, frame_end)`, in the order of emission."""
+        selected = np.flatnonzero((self.index['frame_start'] < frame_end) & (self.index['frame_end'] > frame_start))
+        blocks = []
+        for i in selected:
+            block = self.block(int(i))
+            keep = (frame_start <= block['sample_ind']) & (block['sample_ind'] < frame_end)
+            blocks.append({key: column[keep] for key, column in block.items()})
+        return self._concat(blocks)
@@ -27,6 +27,8 @@ except ImportError:
 
 
 PROFILE = 0  # disabled in release, only use in dev
+STATS = False  # per-stage counters in C++, disabled in release, only use in dev
+PRECISION = 'int16'  # sample type of processing, int16 is the fastest, int32 or float32 for high dynamic range
 NATIVE_OPTIM = True  # enabled for better speed
 FORCE_CYTHONIZE = True  # force rebuild in release, no need to in dev
 
@@ -81,7 +83,9 @@ detect_ext = cythonize(
               sources=sources,
               include_dirs=[numpy_include],
               define_macros=[
-                  ('CYTHON_TRACE_NOGIL', '1' if PROFILE >= 2 else '0')],
+                  ('CYTHON_TRACE_NOGIL', '1' if PROFILE >= 2 else '0')] +
+              [('HSDETECTION_STATS', None)] * STATS +
+              [('HSDETECTION_PRECISION_' + PRECISION.upper(), None)] * (PRECISION != 'int16'),
               extra_compile_args=extra_compile_args,
               extra_link_args=link_extra_args,
               language='c++'),
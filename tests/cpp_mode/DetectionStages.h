@@ -0,0 +1,82 @@
+#ifndef DETECTIONSTAGES_H
+#define DETECTIONSTAGES_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Detection.h"
+
+namespace HSDetection
+{
+    // access to single stages of Detection, declared as friend in Detection.h and SpikeQueue.h,
+    // shared by the benchmarks (bench.cpp) and the equivalence checks (equiv.cpp)
+    struct DetectionStages
+    {
+        Detection *pDet;
+        IntFrame chunkLen;
+
+        DetectionStages(Detection *pDet, FloatRaw *chunk, IntFrame chunkLen) : pDet(pDet), chunkLen(chunkLen)
+        {
+            pDet->traceRaw.updateChunk(chunk, 0);
+        }
+
+        // no rebalance by the cost of channels, with the same arena and binding as otherwise
+        static void keepPartition(Detection *pDet) { pDet->rebalance = false; }
+
+        void cast(IntVolt *medianBuffer) { pDet->castAndCommonref(0, chunkLen, medianBuffer); }
+
+        // estimation and detection are fused per frame (both inline), timed together over all parts
+        void estimateAndDetect()
+        {
+            for (int part = 0; part < pDet->numThreads; part++)
+            {
+                pDet->estimateAndDetect(0, chunkLen, part);
+            }
+        }
+
+        // spikes of all parts in order, as merged by the queue
+        std::vector<Spike> staged()
+        {
+            std::vector<Spike> spikes;
+            for (auto &buffer : pDet->queues[0]->threadBuffers)
+            {
+                spikes.insert(spikes.end(), buffer.spikes.begin(), buffer.spikes.end());
+                buffer.spikes.clear();
+            }
+            std::sort(spikes.begin(), spikes.end(), [](const Spike &lhs, const Spike &rhs)
+                      { return lhs.frame < rhs.frame || (lhs.frame == rhs.frame && lhs.channel < rhs.channel); });
+            return spikes;
+        }
+
+        void stage(const std::vector<Spike> &spikes) { pDet->queues[0]->threadBuffers[0].spikes = spikes; }
+
+        // process the staged spikes through the whole queue, and take the result out
+        std::vector<Spike> queue()
+        {
+            pDet->queues[0]->process(chunkLen);
+            pDet->queues[0]->finalize();
+            std::vector<Spike> result;
+            result.swap(pDet->results[0]);
+            return result;
+        }
+
+        SpikeLocalizer *localizer() { return pDet->queues[0]->pLocalizer; }
+        SpikeShapeWriter *shapeWriter() { return pDet->queues[0]->pShapeWriter; }
+
+        // the rolling arrays placed by first touch if NUMA aware, and the channels of each part [span[i], span[i+1])
+        std::vector<const RollingArray *> touchedArrays() const
+        {
+            return {&pDet->trace, &pDet->runningBaseline, &pDet->runningDeviation};
+        }
+        const std::vector<IntChannel> &partition() const { return pDet->threadChannelSpan; }
+
+        // rows of the rolling arrays at frame t of the chunk, in the compact channel layout
+        const IntVolt *trace(IntFrame t) const { return pDet->trace[t]; }
+        const IntVolt *commonRef(IntFrame t) const { return pDet->commonRef[t]; }
+        const IntVolt *baselines(IntFrame t) const { return pDet->runningBaseline[t]; }
+        const IntVolt *deviations(IntFrame t) const { return pDet->runningDeviation[t]; }
+    };
+
+} // namespace HSDetection
+
+#endif
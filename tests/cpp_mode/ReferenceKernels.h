@@ -0,0 +1,163 @@
+#ifndef REFERENCEKERNELS_H
+#define REFERENCEKERNELS_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Spike.h"
+
+namespace HSDetection
+{
+    // plain scalar copies of the per-frame kernels of Detection.cpp, on all channels of a frame,
+    // kept as the reference that optimized kernels (SIMD, tiled, partitioned) must reproduce bit-exactly
+    // only to be changed together with the intended semantics of detection
+    namespace Reference
+    {
+        constexpr IntVolt initBase = 0;
+        constexpr IntVolt initDev = 400;
+        constexpr IntVolt tauBase = 4;
+        constexpr IntVolt devChange = 1;
+        constexpr IntVolt minDev = 200;
+        constexpr IntCalc thrQuant = 256;
+
+        inline void cast(IntVolt *trace, const FloatRaw *input, const FloatRaw *scale, const FloatRaw *offset,
+                         IntChannel numChannels)
+        {
+            for (IntChannel i = 0; i < numChannels; i++)
+            {
+                trace[i] = input[i] * scale[i] + offset[i];
+            }
+        }
+
+        inline IntVolt commonAverage(const IntVolt *trace, IntChannel numChannels)
+        {
+            VoltCalc sum = 0;
+            for (IntChannel i = 0; i < numChannels; i++)
+            {
+                sum += trace[i];
+            }
+            return sum / numChannels;
+        }
+
+        inline IntVolt commonMedian(const IntVolt *trace, IntChannel numChannels)
+        {
+            std::vector<IntVolt> sorted(trace, trace + numChannels);
+            std::sort(sorted.begin(), sorted.end());
+            return sorted[numChannels / 2];
+        }
+
+        inline void estimation(IntVolt *baselines, IntVolt *deviations, const IntVolt *trace, IntVolt ref,
+                               const IntVolt *basePrev, const IntVolt *devPrev, IntChannel numChannels)
+        {
+            for (IntChannel i = 0; i < numChannels; i++)
+            {
+                IntVolt volt = trace[i] - ref - basePrev[i];
+
+                IntVolt dltBase = 0;
+                if (devPrev[i] < volt)
+                {
+                    dltBase = devPrev[i] / tauBase;
+                }
+                else if (volt < -devPrev[i])
+                {
+                    dltBase = -devPrev[i] / (tauBase * 2);
+                }
+                baselines[i] = basePrev[i] + dltBase;
+
+                IntVolt dltDev = 0;
+                if (devPrev[i] < volt && volt < 5 * devPrev[i])
+                {
+                    dltDev = devChange;
+                }
+                else if ((0 < volt && volt <= devPrev[i]) || 6 * devPrev[i] < volt)
+                {
+                    dltDev = -devChange;
+                }
+                IntVolt dev = devPrev[i] + dltDev;
+                deviations[i] = std::max(dev, minDev);
+            }
+        }
+
+        // state machine of one config on all channels, spikes appended in order of frame then channel
+        class Detector
+        {
+        private:
+            IntChannel numChannels;
+            IntFrame spikeDur;
+            IntFrame ampAvgDur;
+            IntCalc threshold; // quantized by thrQuant
+            IntCalc minAvgAmp;
+            IntCalc maxAHPAmp;
+
+            std::vector<IntFrame> spikeTime; // -1 if not in spike
+            std::vector<IntVolt> spikeAmp;
+            std::vector<VoltCalc> spikeArea;
+            std::vector<bool> hasAHP;
+
+        public:
+            Detector(IntChannel numChannels, IntFrame spikeDur, IntFrame ampAvgDur,
+                     FloatRatio threshold, FloatRatio minAvgAmp, FloatRatio maxAHPAmp)
+                : numChannels(numChannels), spikeDur(spikeDur), ampAvgDur(ampAvgDur),
+                  threshold(threshold * thrQuant), minAvgAmp(minAvgAmp * thrQuant), maxAHPAmp(maxAHPAmp * thrQuant),
+                  spikeTime(numChannels, -1), spikeAmp(numChannels), spikeArea(numChannels), hasAHP(numChannels) {}
+
+            void operator()(std::vector<Spike> &spikes, IntFrame t, const IntVolt *trace, IntVolt ref,
+                            const IntVolt *baselines, const IntVolt *deviations)
+            {
+                for (IntChannel i = 0; i < numChannels; i++)
+                {
+                    IntVolt volt = trace[i] - ref - baselines[i];
+                    VoltCalc voltThr = volt * thrQuant;
+                    VoltCalc maxAHP = maxAHPAmp * deviations[i];
+
+                    if (spikeTime[i] < 0)
+                    {
+                        if (voltThr > threshold * deviations[i])
+                        {
+                            spikeTime[i] = 0;
+                            spikeAmp[i] = volt;
+                            spikeArea[i] = voltThr;
+                            hasAHP[i] = false;
+                        }
+                    }
+                    else if (++spikeTime[i] < ampAvgDur)
+                    {
+                        spikeArea[i] += voltThr;
+                        if (spikeAmp[i] < volt)
+                        {
+                            spikeTime[i] = 0;
+                            spikeAmp[i] = volt;
+                            hasAHP[i] = false;
+                        }
+                    }
+                    else if (spikeTime[i] < spikeDur)
+                    {
+                        if (voltThr < maxAHP)
+                        {
+                            hasAHP[i] = true;
+                        }
+                        else if (spikeAmp[i] < volt)
+                        {
+                            spikeTime[i] = 0;
+                            spikeAmp[i] = volt;
+                            spikeArea[i] += voltThr;
+                            hasAHP[i] = false;
+                        }
+                    }
+                    else
+                    {
+                        if (spikeArea[i] > minAvgAmp * deviations[i] * ampAvgDur && (hasAHP[i] || voltThr < maxAHP))
+                        {
+                            spikes.emplace_back(t - spikeDur, i, spikeAmp[i]);
+                        }
+                        spikeTime[i] = -1;
+                    }
+                }
+            }
+        };
+
+    } // namespace Reference
+
+} // namespace HSDetection
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SYNTHETICRECORDING_H
+#define SYNTHETICRECORDING_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "Types.h"
+
+namespace HSDetection
+{
+    // generator of reproducible synthetic recordings, used in place of downloaded datasets
+    struct SyntheticParams
+    {
+        IntChannel numChannels = 384;
+        IntChannel numColumns = 4;  // channels placed row by row in staggered columns
+        FloatGeom columnPitch = 16; // um between columns
+        FloatGeom rowPitch = 20;    // um between rows
+        double samplingRate = 32000;
+        double seconds = 10;
+        float noiseLevel = 20;    // sd of gaussian noise
+        float spikeRate = 5;      // Hz of spikes per channel
+        float minAmp = 300;       // range of negative peak amplitude
+        float maxAmp = 1500;      //
+        FloatGeom spread = 40;    // um of distance where amplitude halves
+        float activeFraction = 1; // spikes centered only on this fraction of the first channels, for uneven load
+        unsigned int seed = 0;
+    };
+
+    class SyntheticRecording
+    {
+    private:
+        static constexpr IntFrame spikeLen = 30; // rise 5, fall 5, and AHP 20 frames
+
+        static float waveform(IntFrame t)
+        {
+            return t < 5 ? -t / 5.0f : t < 10 ? -(10 - t) / 5.0f
+                                              : 0.2f * (1 - (t - 10) / 20.0f);
+        }
+
+    public:
+        SyntheticParams params;
+        IntFrame numFrames;
+        std::vector<FloatRaw> trace;      // frame-major, numFrames x numChannels, padded for aligned cast
+        std::vector<FloatGeom> positions; // numChannels x XY
+        std::vector<IntFrame> spikeFrames; // ground truth of peak frames
+        std::vector<IntChannel> spikeChannels;
+
+        SyntheticRecording(const SyntheticParams &params)
+            : params(params), numFrames(params.seconds * params.samplingRate),
+              trace((size_t)numFrames * params.numChannels + 64), positions(params.numChannels * 2)
+        {
+            IntChannel numChannels = params.numChannels;
+            for (IntChannel i = 0; i < numChannels; i++)
+            {
+                IntChannel row = i / params.numColumns, column = i % params.numColumns;
+                positions[i * 2] = (column - (params.numColumns - 1) / 2.0f) * params.columnPitch;
+                positions[i * 2 + 1] = (row + (column % 2) / 2.0f) * params.rowPitch;
+            }
+
+            std::mt19937 rng(params.seed);
+            std::normal_distribution<float> noise(0, params.noiseLevel);
+            std::generate_n(trace.begin(), (size_t)numFrames * numChannels, [&]()
+                          { return noise(rng); });
+
+            IntCalc numSpikes = params.spikeRate * params.seconds * numChannels;
+            std::uniform_int_distribution<IntFrame> frameDist(0, std::max(numFrames - spikeLen, 0));
+            std::uniform_int_distribution<IntChannel> channelDist(
+                0, std::max((IntChannel)(numChannels * params.activeFraction), (IntChannel)1) - 1);
+            std::uniform_real_distribution<float> ampDist(params.minAmp, params.maxAmp);
+            for (IntCalc s = 0; s < numSpikes; s++)
+            {
+                IntFrame frame = frameDist(rng);
+                IntChannel channel = channelDist(rng);
+                float amp = ampDist(rng);
+                spikeFrames.push_back(frame + 5);
+                spikeChannels.push_back(channel);
+
+                for (IntChannel c = 0; c < numChannels; c++)
+                {
+                    FloatGeom dis = std::hypot(positions[c * 2] - positions[channel * 2],
+                                               positions[c * 2 + 1] - positions[channel * 2 + 1]);
+                    if (dis > params.spread * 3)
+                    {
+                        continue;
+                    }
+                    float a = amp / (1 + dis / params.spread);
+                    for (IntFrame t = 0; t < spikeLen && frame + t < numFrames; t++)
+                    {
+                        trace[(size_t)(frame + t) * numChannels + c] += a * waveform(t);
+                    }
+                }
+            }
+        }
+
+        // rescale as in the Python interface, which maps the 5%~95% range to rescaleValue
+        FloatRaw getScale(FloatRaw rescaleValue = -1280) const { return rescaleValue / (2 * 1.645f * params.noiseLevel); }
+    };
+
+} // namespace HSDetection
+
+#endif
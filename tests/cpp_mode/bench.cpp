@@ -0,0 +1,454 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <omp.h>
+#include <sys/resource.h>
+
+#include "Detection.h"
+#include "DetectionStages.h"
+#include "SpikeProcessor/SpikeLocalizer.h"
+#include "SpikeProcessor/SpikeShapeWriter.h"
+#include "SyntheticRecording.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace HSDetection;
+
+// default params of the Python interface, in frames at 32kHz
+static constexpr IntFrame chunkLeftMargin = 0;
+static constexpr bool numaAware = false;
+static constexpr IntFrame spikeDur = 32;
+static constexpr IntFrame ampAvgDur = 13;
+static constexpr float threshold = 10.0;
+static constexpr float minAvgAmp = 5.0;
+static constexpr float maxAHPAmp = 0.0;
+static constexpr float neighborRadius = 90.001;
+static constexpr float innerRadius = 70.001;
+static constexpr IntFrame temporalJitter = 6;
+static constexpr IntFrame riseDur = 8;
+static constexpr float decayRatio = 1.0;
+static constexpr char filename[] = "/dev/null";
+static constexpr IntFrame cutoutStart = 10;
+static constexpr IntFrame cutoutEnd = 58;
+
+static map<string, string> args = {
+    {"channels", "384"},   // number of channels of synthetic probe
+    {"columns", "4"},      // columns of synthetic probe
+    {"seconds", "10"},     // length of synthetic recording
+    {"noise", "20"},       // sd of noise
+    {"rate", "5"},         // spikes per second per channel
+    {"seed", "0"},         // seed of generator
+    {"chunk", "32000"},    // chunk size for steps
+    {"min_time", "0.5"},   // seconds to repeat each benchmark at least
+    {"filter", ""},        // only run benchmarks whose name contains this
+    {"threads", "1,2,4"},  // team sizes of the thread scaling benchmarks
+    {"skew", "0.25"},      // fraction of channels with spikes in the partition benchmarks
+    {"out", ""}};          // file to write JSON, stdout if empty
+
+struct BenchResult
+{
+    string name;
+    long iterations;
+    double seconds; // total over iterations
+    double items;   // items per iteration
+    double frames;  // frames per iteration, for realtime factor
+
+    vector<pair<string, double>> counters; // extra per-iteration values, as user counters of Google Benchmark
+};
+
+static vector<BenchResult> results;
+
+// arena of the largest detection made, for the memory in the context
+static IntCalc arenaBytes = 0;
+static const char *arenaPages = "none";
+
+// repeat the iteration until min_time, each iteration times itself to exclude its setup,
+// similar to PauseTiming/ResumeTiming in Google Benchmark
+// counters, if given, are read once after the iterations
+static void runBenchmark(const string &name, double items, double frames, const function<double()> &iteration,
+                         const function<vector<pair<string, double>>(long)> &counters = nullptr)
+{
+    if (name.find(args["filter"]) == string::npos)
+    {
+        return;
+    }
+
+    double minTime = stod(args["min_time"]);
+    BenchResult result{name, 0, 0, items, frames, {}};
+    while (result.seconds < minTime || result.iterations < 1)
+    {
+        result.seconds += iteration();
+        result.iterations++;
+    }
+    if (counters)
+    {
+        result.counters = counters(result.iterations);
+    }
+    results.push_back(result);
+
+    fprintf(stderr, "%-32s %8ld it %12.0f ns/it %12.4g items/s\n", name.c_str(), result.iterations,
+            result.seconds / result.iterations * 1e9, items * result.iterations / result.seconds);
+    for (const pair<string, double> &counter : result.counters)
+    {
+        fprintf(stderr, "%-32s %-20s %12.4g\n", "", counter.first.c_str(), counter.second);
+    }
+}
+
+static double timeIt(const function<void()> &func)
+{
+    steady_clock::time_point start = steady_clock::now();
+    func();
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+// in the schema of Google Benchmark, so that the tools to compare runs can be used
+static void writeJson(FILE *file, const SyntheticRecording &rec)
+{
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+    fprintf(file, "{\n  \"context\": {\n");
+    fprintf(file, "    \"date\": \"%s\",\n", date);
+    fprintf(file, "    \"executable\": \"bench\",\n");
+    fprintf(file, "    \"num_cpus\": %u,\n", thread::hardware_concurrency());
+    fprintf(file, "    \"omp_max_threads\": %d,\n", omp_get_max_threads());
+    fprintf(file, "    \"channels\": %d,\n", rec.params.numChannels);
+    fprintf(file, "    \"frames\": %d,\n", rec.numFrames);
+    fprintf(file, "    \"noise\": %g,\n", rec.params.noiseLevel);
+    fprintf(file, "    \"spike_rate\": %g,\n", rec.params.spikeRate);
+    fprintf(file, "    \"seed\": %u,\n", rec.params.seed);
+    fprintf(file, "    \"precision\": \"%s\",\n", voltDtype);
+    // rolling arrays of trace, baseline and deviation on channels aligned to 64B, and common reference
+    IntChannel channelAlign = 64 / sizeof(IntVolt);
+    IntCalc alignedWidth = (rec.params.numChannels + channelAlign - 1) / channelAlign * channelAlign;
+    fprintf(file, "    \"rolling_bytes_per_frame\": %ld,\n", (long)((alignedWidth * 3 + 1) * sizeof(IntVolt)));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(file, "    \"max_rss_kib\": %ld,\n", usage.ru_maxrss);
+    fprintf(file, "    \"arena_bytes\": %ld,\n", (long)arenaBytes);
+    fprintf(file, "    \"arena_pages\": \"%s\",\n", arenaPages);
+#ifdef NDEBUG
+    fprintf(file, "    \"library_build_type\": \"release\"\n");
+#else
+    fprintf(file, "    \"library_build_type\": \"debug\"\n");
+#endif
+    fprintf(file, "  },\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        double perIter = r.seconds / r.iterations;
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"name\": \"%s\",\n", r.name.c_str());
+        fprintf(file, "      \"run_name\": \"%s\",\n", r.name.c_str());
+        fprintf(file, "      \"run_type\": \"iteration\",\n");
+        fprintf(file, "      \"iterations\": %ld,\n", r.iterations);
+        fprintf(file, "      \"real_time\": %.6e,\n", perIter * 1e9);
+        fprintf(file, "      \"cpu_time\": %.6e,\n", perIter * 1e9); // wall time only, threads not summed
+        fprintf(file, "      \"time_unit\": \"ns\",\n");
+        fprintf(file, "      \"items_per_second\": %.6e,\n", r.items / perIter);
+        for (const pair<string, double> &counter : r.counters)
+        {
+            fprintf(file, "      \"%s\": %.6e,\n", counter.first.c_str(), counter.second);
+        }
+        fprintf(file, "      \"realtime_factor\": %.6e\n", r.frames / rec.params.samplingRate / perIter);
+        fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+static Detection *newDetection(const SyntheticRecording &rec, const vector<FloatRaw> &scale,
+                               const vector<FloatRaw> &offset, IntFrame chunkSize,
+                               bool medianReference, bool decayFiltering, bool localize, bool saveShape,
+                               bool compressShape = false, const bool *channelMask = nullptr,
+                               const vector<DetectionConfig> &sweepConfigs = {}, bool fixedPartition = false)
+{
+    Detection *pDet = new Detection(rec.params.numChannels, chunkSize, chunkLeftMargin, numaAware,
+                                    true, scale.data(), offset.data(),
+                                    medianReference, !medianReference,
+                                    spikeDur, ampAvgDur,
+                                    threshold, minAvgAmp, maxAHPAmp,
+                                    rec.positions.data(), neighborRadius, innerRadius,
+                                    temporalJitter, riseDur,
+                                    decayFiltering, decayRatio, localize,
+                                    saveShape, filename, cutoutStart, cutoutEnd, compressShape, false, channelMask,
+                                    sweepConfigs, "", 0);
+    if (fixedPartition)
+    {
+        DetectionStages::keepPartition(pDet); // the initial equal partition, on the same pages as rebalanced runs
+    }
+    if (pDet->getFootprint() > arenaBytes)
+    {
+        arenaBytes = pDet->getFootprint();
+        arenaPages = pDet->getPageKind();
+    }
+    return pDet;
+}
+
+// whole detection on the recording, as called from Python
+static void macroBenchmarks(SyntheticRecording &rec, const vector<FloatRaw> &scale, const vector<FloatRaw> &offset)
+{
+    IntFrame chunkSize = stoi(args["chunk"]);
+    double items = (double)rec.numFrames * rec.params.numChannels;
+
+    struct Config
+    {
+        string name;
+        bool medianReference, decayFiltering, localize, saveShape, compressShape, masked, sweep;
+    };
+    const Config configs[] = {{"detect/average", false, false, false, false, false, false, false},
+                              {"detect/median", true, false, false, false, false, false, false},
+                              {"detect/decay", false, true, false, false, false, false, false},
+                              {"detect/average_localize", false, false, true, false, false, false, false},
+                              {"detect/average_localize_shape", false, false, true, true, false, false, false},
+                              {"detect/average_localize_shape_compressed", false, false, true, true, true, false, false},
+                              {"detect/average_masked_quarter", false, false, false, false, false, true, false},
+                              {"detect/average_sweep4", false, false, false, false, false, false, true}};
+
+    // every fourth channel left out, items still counted on all input channels
+    unique_ptr<bool[]> quarterMask(new bool[rec.params.numChannels]);
+    for (IntChannel i = 0; i < rec.params.numChannels; i++)
+    {
+        quarterMask[i] = i % 4 == 3;
+    }
+
+    // three more thresholds around the default in the same pass, items still counted once
+    const vector<DetectionConfig> sweepConfigs = {{8.0, minAvgAmp, maxAHPAmp, temporalJitter},
+                                                  {12.0, minAvgAmp, maxAHPAmp, temporalJitter},
+                                                  {14.0, minAvgAmp, maxAHPAmp, temporalJitter}};
+
+    for (const Config &config : configs)
+    {
+        runBenchmark(config.name, items, rec.numFrames, [&]()
+                     {
+            Detection *pDet = newDetection(rec, scale, offset, chunkSize, config.medianReference,
+                                           config.decayFiltering, config.localize, config.saveShape,
+                                           config.compressShape, config.masked ? quarterMask.get() : nullptr,
+                                           config.sweep ? sweepConfigs : vector<DetectionConfig>());
+            double seconds = timeIt([&]()
+                                    {
+                for (IntFrame chunkStart = 0; chunkStart < rec.numFrames; chunkStart += chunkSize)
+                {
+                    pDet->step(rec.trace.data() + (size_t)chunkStart * rec.params.numChannels,
+                               chunkStart, min(chunkSize, rec.numFrames - chunkStart));
+                }
+                pDet->finish(); });
+            delete pDet;
+            return seconds; });
+    }
+}
+
+// team sizes in args, comma separated
+static vector<int> teamSizes()
+{
+    vector<int> sizes;
+    string list = args["threads"];
+    for (size_t start = 0; start < list.size();)
+    {
+        size_t end = min(list.find(',', start), list.size());
+        sizes.push_back(stoi(list.substr(start, end - start)));
+        start = end + 1;
+    }
+    return sizes;
+}
+
+// whole detection with CAR on a team, with the mean time per thread in each stage and the load imbalance
+// (max over mean of the busy time of threads), which need the counters compiled in (make STATS=1)
+static void teamBenchmark(const string &name, SyntheticRecording &rec, const vector<FloatRaw> &scale,
+                          const vector<FloatRaw> &offset, int teamSize, bool fixedPartition)
+{
+    IntFrame chunkSize = stoi(args["chunk"]);
+    double items = (double)rec.numFrames * rec.params.numChannels;
+    int defaultThreads = omp_get_max_threads();
+
+    omp_set_num_threads(teamSize); // read by the Detection when constructed
+    double castTime = 0, waitTime = 0, estimateTime = 0;
+    vector<double> busyTime(teamSize);
+    runBenchmark(name, items, rec.numFrames, [&]()
+                 {
+        Detection *pDet = newDetection(rec, scale, offset, chunkSize, false, false, false, false,
+                                       false, nullptr, {}, fixedPartition);
+        double seconds = timeIt([&]()
+                                {
+            for (IntFrame chunkStart = 0; chunkStart < rec.numFrames; chunkStart += chunkSize)
+            {
+                pDet->step(rec.trace.data() + (size_t)chunkStart * rec.params.numChannels,
+                           chunkStart, min(chunkSize, rec.numFrames - chunkStart));
+            }
+            pDet->finish(); });
+        const vector<ThreadStats> &threads = pDet->getStats().threads;
+        for (int i = 0; i < (int)threads.size() && i < teamSize; i++)
+        {
+            castTime += threads[i].castTime / teamSize;
+            waitTime += threads[i].waitTime / teamSize;
+            estimateTime += threads[i].estimateTime / teamSize;
+            busyTime[i] += threads[i].castTime + threads[i].estimateTime;
+        }
+        delete pDet;
+        return seconds; },
+                 [&](long iterations)
+                 {
+        double meanBusy = accumulate(busyTime.begin(), busyTime.end(), 0.0) / teamSize;
+        double maxBusy = *max_element(busyTime.begin(), busyTime.end());
+        return vector<pair<string, double>>{{"cast_seconds", castTime / iterations},
+                                            {"wait_seconds", waitTime / iterations},
+                                            {"estimate_seconds", estimateTime / iterations},
+                                            {"load_imbalance", meanBusy > 0 ? maxBusy / meanBusy : 1.0}}; });
+    omp_set_num_threads(defaultThreads);
+}
+
+// teams of different sizes, so that cast and wait should stay flat (or shrink) as the team grows if the cast scales
+static void threadBenchmarks(SyntheticRecording &rec, const vector<FloatRaw> &scale, const vector<FloatRaw> &offset)
+{
+    for (int teamSize : teamSizes())
+    {
+        teamBenchmark("detect/average_threads" + to_string(teamSize), rec, scale, offset, teamSize, false);
+    }
+}
+
+// spikes only on the first channels, with the partition kept equal and rebalanced by cost (on the same arena),
+// so that the rebalanced run should have less load imbalance and wait on teams of more than one thread
+static void balanceBenchmarks(const SyntheticRecording &rec, const vector<FloatRaw> &scale, const vector<FloatRaw> &offset)
+{
+    const string names[] = {"detect/skewed_equal_threads", "detect/skewed_balanced_threads"};
+    if (names[0].find(args["filter"]) == string::npos && names[1].find(args["filter"]) == string::npos)
+    {
+        return; // skip generating the recording
+    }
+
+    SyntheticParams params = rec.params;
+    params.activeFraction = stof(args["skew"]);
+    fprintf(stderr, "generating spikes on %g of channels...\n", params.activeFraction);
+    SyntheticRecording skewed(params);
+
+    for (int teamSize : teamSizes())
+    {
+        teamBenchmark(names[0] + to_string(teamSize), skewed, scale, offset, teamSize, true);
+        teamBenchmark(names[1] + to_string(teamSize), skewed, scale, offset, teamSize, false);
+    }
+}
+
+// single stages on one chunk on the calling thread
+static void microBenchmarks(SyntheticRecording &rec, const vector<FloatRaw> &scale, const vector<FloatRaw> &offset)
+{
+    IntFrame chunkLen = min(stoi(args["chunk"]), rec.numFrames);
+    IntChannel numChannels = rec.params.numChannels;
+    double items = (double)chunkLen * numChannels;
+
+    Detection *pDet = newDetection(rec, scale, offset, chunkLen, false, false, true, true);
+    DetectionStages stages(pDet, rec.trace.data(), chunkLen);
+
+    runBenchmark("stage/cast_average", items, chunkLen, [&]()
+                 { return timeIt([&]()
+                                 { stages.cast(nullptr); }); });
+
+    Detection *pMedianDet = newDetection(rec, scale, offset, chunkLen, true, false, false, false);
+    DetectionStages medianStages(pMedianDet, rec.trace.data(), chunkLen);
+    vector<IntVolt> medianBuffer(numChannels);
+    runBenchmark("stage/cast_median", items, chunkLen, [&]()
+                 { return timeIt([&]()
+                                 { medianStages.cast(medianBuffer.data()); }); });
+    delete pMedianDet;
+
+    stages.cast(nullptr); // trace of the last run of cast_average is the input of the following
+
+    runBenchmark("stage/estimate_detect", items, chunkLen, [&]()
+                 {
+        double seconds = timeIt([&]()
+                                { stages.estimateAndDetect(); });
+        stages.staged(); // drop the spikes
+        return seconds; });
+
+    // the spikes detected from the same chunk are the input of queue and processors
+    stages.estimateAndDetect();
+    vector<Spike> detected = stages.staged();
+
+    // queue with finder and filterer only, without the spike processors
+    Detection *pQueueDet = newDetection(rec, scale, offset, chunkLen, false, false, false, false);
+    DetectionStages queueStages(pQueueDet, rec.trace.data(), chunkLen);
+    queueStages.cast(nullptr);
+    queueStages.estimateAndDetect();
+    queueStages.staged();
+    vector<Spike> processed;
+    runBenchmark("stage/queue", detected.size(), chunkLen, [&]()
+                 {
+        queueStages.stage(detected);
+        return timeIt([&]()
+                      { processed = queueStages.queue(); }); });
+    delete pQueueDet;
+
+    vector<Spike> spikes;
+    runBenchmark("stage/localization", processed.size(), chunkLen, [&]()
+                 {
+        spikes = processed;
+        return timeIt([&]()
+                      { for (Spike &spike : spikes) { (*stages.localizer())(&spike); } }); });
+
+    runBenchmark("stage/shape_writing", processed.size(), chunkLen, [&]()
+                 { return timeIt([&]()
+                                 { for (Spike &spike : processed) { (*stages.shapeWriter())(&spike); } }); });
+
+    delete pDet;
+
+    fprintf(stderr, "stage input: %zu detected, %zu after queue\n", detected.size(), processed.size());
+}
+
+int main(int argc, const char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        size_t sep = arg.find('=');
+        if (sep == string::npos || args.count(arg.substr(0, sep)) == 0)
+        {
+            fprintf(stderr, "usage: %s [key=value ...], with keys:\n", argv[0]);
+            for (const auto &kv : args)
+            {
+                fprintf(stderr, "  %s (default: %s)\n", kv.first.c_str(), kv.second.c_str());
+            }
+            return 2;
+        }
+        args[arg.substr(0, sep)] = arg.substr(sep + 1);
+    }
+
+    SyntheticParams params;
+    params.numChannels = stoi(args["channels"]);
+    params.numColumns = stoi(args["columns"]);
+    params.seconds = stod(args["seconds"]);
+    params.noiseLevel = stof(args["noise"]);
+    params.spikeRate = stof(args["rate"]);
+    params.seed = stoul(args["seed"]);
+
+    fprintf(stderr, "generating %d channels for %gs...\n", params.numChannels, params.seconds);
+    SyntheticRecording rec(params);
+    vector<FloatRaw> scale(params.numChannels, rec.getScale()), offset(params.numChannels, 0);
+
+    microBenchmarks(rec, scale, offset);
+    macroBenchmarks(rec, scale, offset);
+    threadBenchmarks(rec, scale, offset);
+    balanceBenchmarks(rec, scale, offset);
+
+    FILE *file = args["out"].empty() ? stdout : fopen(args["out"].c_str(), "w");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "cannot open %s\n", args["out"].c_str());
+        return 1;
+    }
+    writeJson(file, rec);
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+
+    return 0;
+}
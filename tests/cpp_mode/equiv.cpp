@@ -0,0 +1,624 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "Detection.h"
+#include "DetectionStages.h"
+#include "ReferenceKernels.h"
+#include "Snapshot.h"
+#include "SyntheticRecording.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace HSDetection;
+
+// differential checks: the reference kernels (ReferenceKernels.h) against the kernels of the library, and the
+// reference run (one thread, one chunk) against the parallel and chunked variants of the pipeline,
+// bit-exact on randomized recordings and probes, so that optimizations of any stage can be verified
+// the reference runs can also be saved and checked against from another build, for changes of the processors
+
+// fixed params as in bench.cpp, the others are drawn for each case
+static constexpr IntFrame chunkLeftMargin = 0;
+static constexpr IntFrame spikeDur = 32;
+static constexpr IntFrame ampAvgDur = 13;
+static constexpr float minAvgAmp = 5.0;
+static constexpr float maxAHPAmp = 0.0;
+static constexpr float neighborRadius = 90.001;
+static constexpr float innerRadius = 70.001;
+static constexpr IntFrame temporalJitter = 6;
+static constexpr IntFrame riseDur = 8;
+static constexpr float decayRatio = 1.0;
+static constexpr IntFrame cutoutStart = 10;
+static constexpr IntFrame cutoutEnd = 58;
+
+static constexpr char goldenMagic[8] = {'H', 'S', 'E', 'Q', 'U', 'I', 'V', '1'};
+
+static map<string, string> args = {
+    {"cases", "6"},     // number of randomized recordings and probes
+    {"seconds", "0.5"}, // length of each recording
+    {"seed", "1"},      // seed of the first case, the following ones count up
+    {"threads", "4"},   // team size of the parallel variants, also when more than cores
+    {"filter", ""},     // only run checks whose name contains this
+    {"save", ""},       // file to write the reference runs, for against= in another build
+    {"against", ""}};   // file of save= from another build, the reference runs should match
+
+// drawn for each case
+struct CaseParams
+{
+    SyntheticParams synth;
+    bool medianReference;
+    bool decayFiltering;
+    float threshold;
+};
+
+struct CheckResult
+{
+    int caseNum;
+    string name;
+    long compared;     // values compared
+    long mismatches;   // values different, or missing on either side
+    double refSeconds; // 0 if not timed
+    double varSeconds;
+};
+
+static vector<CheckResult> checks;
+
+static bool selected(const string &name) { return name.find(args["filter"]) != string::npos; }
+
+static double timeIt(const function<void()> &func)
+{
+    steady_clock::time_point start = steady_clock::now();
+    func();
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static void report(int caseNum, const string &name, long compared, long mismatches,
+                   double refSeconds = 0, double varSeconds = 0)
+{
+    checks.push_back({caseNum, name, compared, mismatches, refSeconds, varSeconds});
+}
+
+// bitwise on all fields, so that -0.0 and NaN positions also count
+static bool sameSpike(const Spike &lhs, const Spike &rhs, bool withPosition)
+{
+    return lhs.frame == rhs.frame && lhs.channel == rhs.channel &&
+           memcmp(&lhs.amplitude, &rhs.amplitude, sizeof(IntVolt)) == 0 &&
+           (!withPosition || memcmp(&lhs.position, &rhs.position, sizeof(Point)) == 0);
+}
+
+// localization reads the baseline riseDur before the peak and the trace within temporalJitter around it,
+// the positions of spikes closer to the ends of the recording than that use frames never given (stale content
+// of the rolling arrays depending on the split into chunks), so they are not compared
+static bool locatedInRecording(const Spike &spike, IntFrame numFrames)
+{
+    return spike.frame - max(riseDur, temporalJitter) >= 0 && spike.frame + temporalJitter < numFrames;
+}
+
+// in order of emission, the first mismatch is printed for debugging, positions compared if numFrames given
+static long compareSpikes(const string &what, const vector<Spike> &expected, const vector<Spike> &actual,
+                          IntFrame numFrames = 0)
+{
+    long mismatches = abs((long)expected.size() - (long)actual.size());
+    bool printed = false;
+    for (size_t i = 0; i < min(expected.size(), actual.size()); i++)
+    {
+        if (sameSpike(expected[i], actual[i], numFrames > 0 && locatedInRecording(expected[i], numFrames)))
+        {
+            continue;
+        }
+        mismatches++;
+        if (!printed)
+        {
+            const Spike &e = expected[i], &a = actual[i];
+            fprintf(stderr, "  %s: spike %zu differs, expected (%d, %d, %g, %g, %g), got (%d, %d, %g, %g, %g)\n",
+                    what.c_str(), i, e.frame, e.channel, (double)e.amplitude, e.position.x, e.position.y,
+                    a.frame, a.channel, (double)a.amplitude, a.position.x, a.position.y);
+            printed = true;
+        }
+    }
+    if (!printed && expected.size() != actual.size())
+    {
+        fprintf(stderr, "  %s: %zu spikes expected, got %zu\n", what.c_str(), expected.size(), actual.size());
+    }
+    return mismatches;
+}
+
+static long compareVolts(const string &what, IntFrame t, const IntVolt *expected, const IntVolt *actual,
+                         IntChannel numChannels, bool &printed)
+{
+    long mismatches = 0;
+    for (IntChannel i = 0; i < numChannels; i++)
+    {
+        if (memcmp(&expected[i], &actual[i], sizeof(IntVolt)) == 0)
+        {
+            continue;
+        }
+        mismatches++;
+        if (!printed)
+        {
+            fprintf(stderr, "  %s: frame %d channel %d differs, expected %g, got %g\n",
+                    what.c_str(), t, i, (double)expected[i], (double)actual[i]);
+            printed = true;
+        }
+    }
+    return mismatches;
+}
+
+static Detection *newDetection(const CaseParams &params, const SyntheticRecording &rec,
+                               const vector<FloatRaw> &scale, const vector<FloatRaw> &offset,
+                               IntFrame chunkSize, bool numaAware, bool localize, const string &shapeFilename,
+                               const vector<DetectionConfig> &sweepConfigs = {})
+{
+    return new Detection(rec.params.numChannels, chunkSize, chunkLeftMargin, numaAware,
+                         true, scale.data(), offset.data(),
+                         params.medianReference, !params.medianReference,
+                         spikeDur, ampAvgDur,
+                         params.threshold, minAvgAmp, maxAHPAmp,
+                         rec.positions.data(), neighborRadius, innerRadius,
+                         temporalJitter, riseDur,
+                         params.decayFiltering, decayRatio, localize,
+                         !shapeFilename.empty(), shapeFilename, cutoutStart, cutoutEnd, false, false, nullptr,
+                         sweepConfigs, "", 0);
+}
+
+// cast, estimation and detection of the library on the whole recording as one chunk, against the reference
+static void kernelChecks(int caseNum, const CaseParams &params, SyntheticRecording &rec,
+                         const vector<FloatRaw> &scale, const vector<FloatRaw> &offset)
+{
+    IntFrame numFrames = rec.numFrames;
+    IntChannel numChannels = rec.params.numChannels;
+
+    // reference on its own buffers, the frame before the recording holds the initial estimation
+    vector<IntVolt> trace((size_t)numFrames * numChannels), ref(numFrames);
+    vector<IntVolt> baselines((size_t)(numFrames + 1) * numChannels, Reference::initBase);
+    vector<IntVolt> deviations((size_t)(numFrames + 1) * numChannels, Reference::initDev);
+    vector<Spike> refSpikes;
+
+    double refCast = timeIt([&]()
+                            {
+        for (IntFrame t = 0; t < numFrames; t++)
+        {
+            IntVolt *row = trace.data() + (size_t)t * numChannels;
+            Reference::cast(row, rec.trace.data() + (size_t)t * numChannels, scale.data(), offset.data(), numChannels);
+            ref[t] = params.medianReference ? Reference::commonMedian(row, numChannels)
+                                            : Reference::commonAverage(row, numChannels);
+        } });
+
+    Reference::Detector detector(numChannels, spikeDur, ampAvgDur, params.threshold, minAvgAmp, maxAHPAmp);
+    double refDetect = timeIt([&]()
+                              {
+        for (IntFrame t = 0; t < numFrames; t++)
+        {
+            size_t row = (size_t)t * numChannels, nextRow = row + numChannels;
+            Reference::estimation(baselines.data() + nextRow, deviations.data() + nextRow, trace.data() + row, ref[t],
+                                  baselines.data() + row, deviations.data() + row, numChannels);
+            detector(refSpikes, t, trace.data() + row, ref[t], baselines.data() + nextRow, deviations.data() + nextRow);
+        } });
+
+    Detection *pDet = newDetection(params, rec, scale, offset, numFrames, false, false, "");
+    DetectionStages stages(pDet, rec.trace.data(), numFrames);
+    vector<IntVolt> medianBuffer(numChannels);
+
+    double varCast = timeIt([&]()
+                            { stages.cast(medianBuffer.data()); });
+    double varDetect = timeIt([&]()
+                              { stages.estimateAndDetect(); });
+
+    if (selected("kernel/cast"))
+    {
+        long mismatches = 0;
+        bool printed = false;
+        for (IntFrame t = 0; t < numFrames; t++)
+        {
+            mismatches += compareVolts("kernel/cast", t, trace.data() + (size_t)t * numChannels,
+                                       stages.trace(t), numChannels, printed);
+            mismatches += compareVolts("kernel/cast (reference)", t, &ref[t], stages.commonRef(t), 1, printed);
+        }
+        report(caseNum, "kernel/cast", (long)numFrames * (numChannels + 1), mismatches, refCast, varCast);
+    }
+
+    if (selected("kernel/estimate_detect"))
+    {
+        long mismatches = 0;
+        bool printed = false;
+        for (IntFrame t = 0; t < numFrames; t++)
+        {
+            size_t nextRow = (size_t)(t + 1) * numChannels;
+            mismatches += compareVolts("kernel/estimate_detect (baseline)", t, baselines.data() + nextRow,
+                                       stages.baselines(t), numChannels, printed);
+            mismatches += compareVolts("kernel/estimate_detect (deviation)", t, deviations.data() + nextRow,
+                                       stages.deviations(t), numChannels, printed);
+        }
+        vector<Spike> spikes = stages.staged();
+        mismatches += compareSpikes("kernel/estimate_detect", refSpikes, spikes);
+        report(caseNum, "kernel/estimate_detect", (long)numFrames * numChannels * 2 + refSpikes.size(), mismatches,
+               refDetect, varDetect);
+    }
+
+    delete pDet;
+}
+
+struct Run
+{
+    vector<Spike> spikes;   // of the main config
+    vector<IntVolt> shapes; // cutoutLen samples for each spike, as in the shape file
+    double seconds;
+};
+
+// shapes of the same spikes, on the frames of the recording only, as cutouts over its ends read frames never given
+static long compareShapes(const string &what, const vector<Spike> &spikes,
+                          const vector<IntVolt> &expected, const vector<IntVolt> &actual, IntFrame numFrames)
+{
+    IntFrame cutoutLen = cutoutStart + 1 + cutoutEnd;
+    long mismatches = 0;
+    for (size_t i = 0; i < spikes.size(); i++)
+    {
+        IntFrame first = max(cutoutStart - spikes[i].frame, 0);
+        IntFrame last = min(numFrames - (spikes[i].frame - cutoutStart), cutoutLen);
+        size_t offset = i * cutoutLen;
+        if (first < last && memcmp(&expected[offset + first], &actual[offset + first],
+                                   (last - first) * sizeof(IntVolt)) != 0)
+        {
+            if (mismatches == 0)
+            {
+                fprintf(stderr, "  %s: shape of spike %zu differs\n", what.c_str(), i);
+            }
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// the whole pipeline in steps of the given lengths, with localization and shapes
+static Run runPipeline(const CaseParams &params, SyntheticRecording &rec,
+                       const vector<FloatRaw> &scale, const vector<FloatRaw> &offset,
+                       int numThreads, bool numaAware, IntFrame chunkSize, const vector<IntFrame> &steps,
+                       const vector<DetectionConfig> &sweepConfigs = {})
+{
+    string shapeFilename = (filesystem::temp_directory_path() / ("hs-equiv-" + to_string(getpid()) + ".bin")).string();
+
+    omp_set_num_threads(numThreads);
+    Detection *pDet = newDetection(params, rec, scale, offset, chunkSize, numaAware, true, shapeFilename,
+                                   sweepConfigs);
+
+    Run run;
+    run.seconds = timeIt([&]()
+                         {
+        IntFrame chunkStart = 0;
+        for (IntFrame stepLen : steps)
+        {
+            pDet->step(rec.trace.data() + (size_t)chunkStart * rec.params.numChannels, chunkStart, stepLen);
+            chunkStart += stepLen;
+        }
+        pDet->finish(); });
+    run.spikes.assign(pDet->getResult(), pDet->getResult() + pDet->getNumResult());
+    delete pDet; // shape file closed
+
+    ifstream shapeFile(shapeFilename, ios::binary);
+    run.shapes.resize(run.spikes.size() * (cutoutStart + 1 + cutoutEnd));
+    shapeFile.read((char *)run.shapes.data(), run.shapes.size() * sizeof(IntVolt));
+    shapeFile.close();
+    filesystem::remove(shapeFilename);
+
+    return run;
+}
+
+// random lengths in [minLen, maxLen] covering the recording
+static vector<IntFrame> randomSteps(mt19937 &rng, IntFrame numFrames, IntFrame minLen, IntFrame maxLen)
+{
+    uniform_int_distribution<IntFrame> lenDist(minLen, maxLen);
+    vector<IntFrame> steps;
+    for (IntFrame chunkStart = 0; chunkStart < numFrames; chunkStart += steps.back())
+    {
+        steps.push_back(min(lenDist(rng), numFrames - chunkStart));
+    }
+    return steps;
+}
+
+// variants of the pipeline that should give the same spikes and shapes as the reference run
+static void pipelineChecks(int caseNum, const CaseParams &params, SyntheticRecording &rec,
+                           const vector<FloatRaw> &scale, const vector<FloatRaw> &offset,
+                           const Run &reference, mt19937 &rng)
+{
+    IntFrame numFrames = rec.numFrames;
+    int numThreads = stoi(args["threads"]);
+    IntFrame chunkSize = uniform_int_distribution<IntFrame>(64, 8192)(rng);
+
+    struct Variant
+    {
+        string name;
+        int numThreads;
+        bool numaAware;
+        IntFrame chunkSize;
+        vector<IntFrame> steps;
+        vector<DetectionConfig> sweepConfigs;
+    };
+    const Variant variants[] = {
+        {"pipeline/threads", numThreads, false, numFrames, {numFrames}, {}},
+        {"pipeline/chunks", numThreads, false, chunkSize, randomSteps(rng, numFrames, 1, chunkSize), {}},
+        {"pipeline/online", numThreads, false, 128, randomSteps(rng, numFrames, 1, 128), {}},
+        {"pipeline/numa", numThreads, true, 4096, randomSteps(rng, numFrames, 4096, 4096), {}},
+        {"pipeline/sweep", numThreads, false, chunkSize, randomSteps(rng, numFrames, chunkSize, chunkSize),
+         {{params.threshold - 2, minAvgAmp, maxAHPAmp, temporalJitter},
+          {params.threshold + 2, minAvgAmp, maxAHPAmp, temporalJitter + 2}}}};
+
+    for (const Variant &variant : variants)
+    {
+        if (!selected(variant.name))
+        {
+            continue;
+        }
+
+        Run run = runPipeline(params, rec, scale, offset, variant.numThreads, variant.numaAware,
+                              variant.chunkSize, variant.steps, variant.sweepConfigs);
+        long mismatches = compareSpikes(variant.name, reference.spikes, run.spikes, numFrames);
+        if (mismatches == 0)
+        {
+            mismatches += compareShapes(variant.name, reference.spikes, reference.shapes, run.shapes, numFrames);
+        }
+        report(caseNum, variant.name, reference.spikes.size() * 2, mismatches, reference.seconds, run.seconds);
+    }
+}
+
+// nodes of the pages of the rolling arrays after the first touch of a NUMA aware detection, by move_pages:
+// each page should be on the node of the thread owning its first channel, and the share of the elements
+// on the node of the thread owning them shows how local the frame-major rows actually are
+static void numaChecks(int caseNum, const CaseParams &params, SyntheticRecording &rec,
+                       const vector<FloatRaw> &scale, const vector<FloatRaw> &offset)
+{
+#ifdef __linux__
+    if (!selected("numa/pages"))
+    {
+        return;
+    }
+
+    int numThreads = stoi(args["threads"]);
+    omp_set_num_threads(numThreads);
+    Detection *pDet = newDetection(params, rec, scale, offset, 4096, true, false, "");
+    DetectionStages stages(pDet, rec.trace.data(), 0);
+    const vector<IntChannel> &span = stages.partition();
+
+    // same team and binding as the first touch in the constructor
+    vector<int> threadNode(numThreads, -1);
+#pragma omp parallel num_threads(numThreads) proc_bind(spread)
+    {
+        unsigned int cpu, node;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+        {
+            threadNode[omp_get_thread_num()] = node;
+        }
+    }
+
+    constexpr uintptr_t pageSize = 4096;
+    long compared = 0, mismatches = 0;
+    IntCalc elements = 0, localElements = 0;
+    map<int, long> nodePages;
+    for (const RollingArray *pArray : stages.touchedArrays())
+    {
+        // whole pages only, the first and last ones are shared with the neighbouring buffers of the arena
+        IntChannel rowLen = pArray->getNumChannels();
+        uintptr_t bufferStart = (uintptr_t)(*pArray)[0];
+        uintptr_t bufferEnd = bufferStart + (IntCalc)pArray->getRollingLen() * rowLen * sizeof(IntVolt);
+        vector<void *> pages;
+        for (uintptr_t page = (bufferStart + pageSize - 1) / pageSize * pageSize; page + pageSize <= bufferEnd;
+             page += pageSize)
+        {
+            pages.push_back((void *)page);
+        }
+        vector<int> status(pages.size());
+        if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0)
+        {
+            fprintf(stderr, "numa/pages: move_pages not available, pages not checked\n");
+            delete pDet;
+            return;
+        }
+
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            nodePages[status[i]]++;
+            IntCalc pageStart = ((uintptr_t)pages[i] - bufferStart) / sizeof(IntVolt);
+            for (IntCalc element = pageStart; element < pageStart + (IntCalc)(pageSize / sizeof(IntVolt)); element++)
+            {
+                int part = upper_bound(span.begin(), span.end(), element % rowLen) - span.begin() - 1;
+                if (element == pageStart)
+                {
+                    mismatches += status[i] != threadNode[part];
+                }
+                localElements += status[i] == threadNode[part];
+            }
+            elements += pageSize / sizeof(IntVolt);
+        }
+        compared += pages.size();
+    }
+    delete pDet;
+
+    fprintf(stderr, "numa/pages: %ld pages, by node", compared);
+    for (const auto &kv : nodePages)
+    {
+        fprintf(stderr, " %d:%ld", kv.first, kv.second); // negative for errors, e.g. -2 (ENOENT) if never touched
+    }
+    fprintf(stderr, ", %.1f%% of elements on the node of their thread\n", 100.0 * localElements / max(elements, (IntCalc)1));
+    report(caseNum, "numa/pages", compared, mismatches);
+#endif
+}
+
+// the args and precision that the cases are drawn from, cases in both files are checked by their number
+static string goldenKey() { return "seed=" + args["seed"] + " seconds=" + args["seconds"] + " " + voltDtype; }
+
+static void writeGolden(ostream &out, const vector<vector<Spike>> &results)
+{
+    string key = goldenKey();
+    Snapshot::write(out, goldenMagic);
+    Snapshot::write(out, (IntCalc)key.size());
+    Snapshot::write(out, key.data(), key.size());
+    Snapshot::write(out, (IntCalc)results.size());
+    for (const vector<Spike> &spikes : results)
+    {
+        Snapshot::write(out, (IntCalc)spikes.size());
+        for (const Spike &spike : spikes)
+        {
+            Snapshot::writeSpike(out, spike);
+        }
+    }
+}
+
+static vector<vector<Spike>> readGolden(istream &in)
+{
+    char magic[sizeof(goldenMagic)];
+    Snapshot::read(in, magic, sizeof(magic));
+    if (memcmp(magic, goldenMagic, sizeof(magic)) != 0)
+    {
+        throw runtime_error("equiv: not a file of save=");
+    }
+    string key(Snapshot::read<IntCalc>(in), '\0');
+    Snapshot::read(in, &key[0], key.size());
+    if (key != goldenKey())
+    {
+        throw runtime_error("equiv: results to check against are of other cases (" + key + ")");
+    }
+
+    vector<vector<Spike>> results(Snapshot::read<IntCalc>(in));
+    for (vector<Spike> &spikes : results)
+    {
+        IntCalc numSpikes = Snapshot::read<IntCalc>(in);
+        for (IntCalc i = 0; i < numSpikes; i++)
+        {
+            spikes.push_back(Snapshot::readSpike(in));
+        }
+    }
+    return results;
+}
+
+static CaseParams drawCase(mt19937 &rng, unsigned int seed)
+{
+    CaseParams params;
+    params.synth.numChannels = uniform_int_distribution<IntChannel>(4, 520)(rng); // mostly not multiples of lanes
+    params.synth.numColumns = min(params.synth.numChannels, 1 << uniform_int_distribution<int>(0, 3)(rng));
+    params.synth.columnPitch = uniform_real_distribution<FloatGeom>(10, 40)(rng);
+    params.synth.rowPitch = uniform_real_distribution<FloatGeom>(10, 40)(rng);
+    params.synth.seconds = stod(args["seconds"]);
+    params.synth.noiseLevel = uniform_real_distribution<float>(10, 40)(rng);
+    params.synth.spikeRate = uniform_real_distribution<float>(2, 30)(rng);
+    params.synth.seed = seed;
+    params.medianReference = bernoulli_distribution(0.5)(rng);
+    params.decayFiltering = bernoulli_distribution(0.5)(rng);
+    params.threshold = uniform_real_distribution<float>(6, 14)(rng);
+    return params;
+}
+
+int main(int argc, const char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        size_t sep = arg.find('=');
+        if (sep == string::npos || args.count(arg.substr(0, sep)) == 0)
+        {
+            fprintf(stderr, "usage: %s [key=value ...], with keys:\n", argv[0]);
+            for (const auto &kv : args)
+            {
+                fprintf(stderr, "  %s (default: %s)\n", kv.first.c_str(), kv.second.c_str());
+            }
+            return 2;
+        }
+        args[arg.substr(0, sep)] = arg.substr(sep + 1);
+    }
+
+    int numCases = stoi(args["cases"]);
+    unsigned int firstSeed = stoul(args["seed"]);
+    vector<vector<Spike>> golden;
+    if (!args["against"].empty())
+    {
+        ifstream in(args["against"], ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "cannot open %s\n", args["against"].c_str());
+            return 2;
+        }
+        try
+        {
+            golden = readGolden(in);
+        }
+        catch (const runtime_error &e)
+        {
+            fprintf(stderr, "%s\n", e.what());
+            return 2;
+        }
+    }
+    vector<vector<Spike>> results;
+
+    for (int caseNum = 0; caseNum < numCases; caseNum++)
+    {
+        mt19937 rng(firstSeed + caseNum);
+        CaseParams params = drawCase(rng, firstSeed + caseNum);
+        fprintf(stderr, "case %d: %d channels in %d columns, %s reference, %s filtering, threshold %.2f\n",
+                caseNum, params.synth.numChannels, params.synth.numColumns,
+                params.medianReference ? "median" : "average", params.decayFiltering ? "decay" : "normal",
+                params.threshold);
+
+        SyntheticRecording rec(params.synth);
+        vector<FloatRaw> scale(params.synth.numChannels), offset(params.synth.numChannels);
+        uniform_real_distribution<FloatRaw> gainDist(0.8, 1.2), offsetDist(-50, 50);
+        for (IntChannel i = 0; i < params.synth.numChannels; i++)
+        {
+            scale[i] = rec.getScale() * gainDist(rng);
+            offset[i] = offsetDist(rng);
+        }
+
+        omp_set_num_threads(stoi(args["threads"]));
+        kernelChecks(caseNum, params, rec, scale, offset);
+
+        Run reference = runPipeline(params, rec, scale, offset, 1, false, rec.numFrames, {rec.numFrames});
+        pipelineChecks(caseNum, params, rec, scale, offset, reference, rng);
+        numaChecks(caseNum, params, rec, scale, offset);
+
+        if (caseNum < (int)golden.size() && selected("golden"))
+        {
+            report(caseNum, "golden", reference.spikes.size(),
+                   compareSpikes("golden", golden[caseNum], reference.spikes, rec.numFrames));
+        }
+        results.push_back(move(reference.spikes));
+    }
+
+    if (!args["save"].empty())
+    {
+        ofstream out(args["save"], ios::binary);
+        writeGolden(out, results);
+    }
+
+    long failed = 0;
+    printf("%4s  %-24s %10s %10s %10s %10s %8s\n", "case", "check", "compared", "mismatches", "ref ms", "var ms", "speedup");
+    for (const CheckResult &check : checks)
+    {
+        printf("%4d  %-24s %10ld %10ld", check.caseNum, check.name.c_str(), check.compared, check.mismatches);
+        if (check.refSeconds > 0 && check.varSeconds > 0)
+        {
+            printf(" %10.2f %10.2f %7.2fx\n", check.refSeconds * 1e3, check.varSeconds * 1e3,
+                   check.refSeconds / check.varSeconds);
+        }
+        else
+        {
+            printf(" %10s %10s %8s\n", "-", "-", "-");
+        }
+        failed += check.mismatches != 0;
+    }
+    printf("%zu checks, %ld with mismatches\n", checks.size(), failed);
+
+    return failed == 0 ? 0 : 1;
+}
@@ -1,10 +1,11 @@
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
-#include <fstream>
 #include <algorithm>
+#include <vector>
 
 #include "Detection.h"
+#include "TraceReader/MdaReader.h"
 
 using namespace std;
 using namespace std::filesystem;
@@ -13,12 +14,12 @@ using namespace HSDetection;
 static constexpr int MULT = 1;
 
 static constexpr char dataFn[] = "../../data/sub-MEAREC-250neuron-Neuropixels_ecephys.mda/raw.mda";
-static constexpr int dataOffset = 20;
 static constexpr int dataLen = 19200000 / MULT;
 
 static constexpr int numChannels = 384 * MULT;
 static constexpr int chunkSize = 100000; // based on MULT
 static constexpr int chunkLeftMargin = 75;
+static constexpr bool numaAware = false;
 static constexpr bool rescale = true;
 static unsigned char scale[numChannels * sizeof(float)] = {
     0xB1, 0xAF, 0xCF, 0xC1, 0xA5, 0xF4, 0xCF, 0xC1, 0x3F, 0x64, 0xCE, 0xC1, 0x1C, 0x11, 0xC1, 0xC1,
@@ -231,6 +232,12 @@ static constexpr float decayRatio = 1.0;
 static constexpr bool localize = true;
 static constexpr bool saveShape = true;
 static constexpr char filename[] = "/dev/null";
+static constexpr bool compressShape = false;
+static constexpr bool neighborShape = false;
+static constexpr const bool *channelMask = nullptr; // all channels in use
+static const vector<DetectionConfig> sweepConfigs;  // only the main config
+static constexpr char tableFilename[] = "";         // no spike table
+static constexpr float artifactFraction = 0;        // no artifact blanking
 static constexpr int cutoutStart = 10;
 static constexpr int cutoutEnd = 58;
 static constexpr unsigned int expectCnt[] = {
@@ -270,7 +277,12 @@ int main(int argc, const char **argv)
     fprintf(stderr, "\n");
 
     path dataPath = path(argv[0]).parent_path() / path(dataFn);
-    ifstream dataFile(dataPath.c_str(), ios::binary);
+    MdaReader dataReader(dataPath.string());
+    if (dataReader.getNumChannels() != numChannels || dataReader.getNumFrames() < dataLen)
+    {
+        fprintf(stderr, "ERROR in data file! %d channels, %d frames\n",
+                dataReader.getNumChannels(), dataReader.getNumFrames());
+    }
 
     int chunkPercent = (argc > 1) ? atoi(argv[1]) : 5;
     int numChunks = (dataLen / chunkSize + 9) / 10 * chunkPercent / 10;
@@ -293,23 +305,8 @@ int main(int argc, const char **argv)
             fprintf(stderr, "\n");
         }
 
-        // long long is needed to mult numChannels
-        long long left = i * chunkSize - chunkLeftMargin;
-        long long right = i * chunkSize + chunkSize;
-        long long bufStart = 0;
-        if (left < 0)
-        {
-            bufStart = -left * numChannels;
-            left = 0;
-        }
-
-        dataFile.seekg(dataOffset + left * numChannels * sizeof(float))
-            .read((char *)(buffers[i] + bufStart), (right - left) * numChannels * sizeof(float));
-        if (!dataFile.good())
-        {
-            fprintf(stderr, "ERROR in file reading at chunk %4d/%4d! fail %d, bad %d, eof %d\n",
-                    i, numChunks, dataFile.fail(), dataFile.bad(), dataFile.eof());
-        }
+        // frames before start are filled with zeros
+        dataReader.read(buffers[i], i * chunkSize - chunkLeftMargin, chunkSize + chunkLeftMargin);
     }
     fprintf(stderr, "\n");
 
@@ -317,7 +314,7 @@ int main(int argc, const char **argv)
     {
         fprintf(stderr, "repeat: %2d\n", i);
 
-        Detection *pDet = new Detection(numChannels, chunkSize, chunkLeftMargin,
+        Detection *pDet = new Detection(numChannels, chunkSize, chunkLeftMargin, numaAware,
                                         rescale, (float *)scale, (float *)offset,
                                         medianReference, averageReference,
                                         spikeDur, ampAvgDur,
@@ -325,7 +322,8 @@ int main(int argc, const char **argv)
                                         channelPositions, neighborRadius, innerRadius,
                                         temporalJitter, riseDur,
                                         decayFiltering, decayRatio, localize,
-                                        saveShape, filename, cutoutStart, cutoutEnd);
+                                        saveShape, filename, cutoutStart, cutoutEnd, compressShape, neighborShape,
+                                        channelMask, sweepConfigs, tableFilename, artifactFraction);
 
         for (int j = 0; j < numChunks; j++)
         {
@@ -343,10 +341,29 @@ int main(int argc, const char **argv)
         fprintf(stderr, "detected spikes: %6d\n", resultCnt);
         fprintf(stderr, "expected number: %6d\n", expectCnt[chunkPercent]);
         // fprintf(stderr, "expected around: %6d\n", 32 * numChunks * chunkSize / 1000);
-        fprintf(stderr, "first spike: %8d, %3d, %5d, %9.4f, %9.4f\n",
-                result.frame, result.channel, result.amplitude, result.position.x, result.position.y);
-        fprintf(stderr, "expected is: %8d, %3d, %5d, %9.4f, %9.4f\n",
-                404, 119, 9484, -10.6043, -973.8785);
+        fprintf(stderr, "first spike: %8d, %3d, %5.0f, %9.4f, %9.4f\n",
+                result.frame, result.channel, (double)result.amplitude, result.position.x, result.position.y);
+        fprintf(stderr, "expected is: %8d, %3d, %5.0f, %9.4f, %9.4f\n",
+                404, 119, 9484.0, -10.6043, -973.8785);
+
+        if constexpr (collectStats)
+        {
+            const DetectionStats &stats = pDet->getStats();
+            fprintf(stderr, "steps: %ld, step time: %.3fs, queue time: %.3fs\n",
+                    (long)stats.numSteps, stats.stepTime, stats.queueTime);
+            for (size_t t = 0; t < stats.threads.size(); t++)
+            {
+                fprintf(stderr, "thread %2zu: cast %.3fs, estimate %.3fs, wait %.3fs\n", t,
+                        stats.threads[t].castTime, stats.threads[t].estimateTime, stats.threads[t].waitTime);
+            }
+            fprintf(stderr, "queue: %ld detected, %ld emitted, peak length %ld\n",
+                    (long)stats.numDetected, (long)stats.numEmitted, (long)stats.peakQueueLen);
+            double perSpike = stats.numEmitted > 0 ? 1e9 / stats.numEmitted : 0;
+            fprintf(stderr, "per spike (ns): finder %.0f, filter %.0f, localize %.0f, shape %.0f\n",
+                    stats.finderTime * perSpike, stats.filterTime * perSpike,
+                    stats.localizeTime * perSpike, stats.shapeTime * perSpike);
+            fprintf(stderr, "shape bytes: %ld\n", (long)stats.shapeBytes);
+        }
 
         delete pDet;
         fprintf(stderr, "\n");
@@ -358,8 +375,6 @@ int main(int argc, const char **argv)
     }
     delete[] buffers;
 
-    dataFile.close();
-
     fprintf(stderr, "Success\n");
 
     return 0;
@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Detection.h"
+#include "SyntheticRecording.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace HSDetection;
+
+static constexpr int numChannels = 384;
+static constexpr double samplingRate = 32000;
+static constexpr int chunkLeftMargin = 0; // online blocks are passed without margin
+static constexpr bool numaAware = false;
+static constexpr bool rescale = true;
+static constexpr bool medianReference = false;
+static constexpr bool averageReference = true;
+static constexpr int spikeDur = 32;
+static constexpr int ampAvgDur = 13;
+static constexpr float threshold = 10.0;
+static constexpr float minAvgAmp = 5.0;
+static constexpr float maxAHPAmp = 0.0;
+static constexpr float neighborRadius = 90.001;
+static constexpr float innerRadius = 70.001;
+static constexpr int temporalJitter = 6;
+static constexpr int riseDur = 8;
+static constexpr bool decayFiltering = false;
+static constexpr float decayRatio = 1.0;
+static constexpr bool localize = true;
+static constexpr bool saveShape = false;
+static constexpr char filename[] = "/dev/null";
+static constexpr bool compressShape = false;
+static constexpr bool neighborShape = false;
+static constexpr const bool *channelMask = nullptr; // all channels in use
+static const vector<DetectionConfig> sweepConfigs;  // only the main config
+static constexpr char tableFilename[] = "";         // no spike table
+static constexpr float artifactFraction = 0;        // no artifact blanking
+static constexpr int cutoutStart = 10;
+static constexpr int cutoutEnd = 58;
+
+static double percentile(vector<double> &values, double p)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    size_t k = min((size_t)(p / 100 * values.size()), values.size() - 1);
+    nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+int main(int argc, const char **argv)
+{
+    int blockLen = (argc > 1) ? atoi(argv[1]) : 32; // one acquisition packet, 1ms by default
+    int seconds = (argc > 2) ? atoi(argv[2]) : 10;
+
+    fprintf(stderr, "stream of %d channels at %.0fHz for %ds, in blocks of %d frames\n",
+            numChannels, samplingRate, seconds, blockLen);
+
+    SyntheticParams params;
+    params.numChannels = numChannels;
+    params.samplingRate = samplingRate;
+    params.seconds = seconds;
+    SyntheticRecording stream(params);
+    vector<float> scale(numChannels, stream.getScale()), offset(numChannels, 0);
+
+    int numFrames = stream.numFrames / blockLen * blockLen;
+    int numBlocks = numFrames / blockLen;
+
+    Detection *pDet = new Detection(numChannels, blockLen, chunkLeftMargin, numaAware,
+                                    rescale, scale.data(), offset.data(),
+                                    medianReference, averageReference,
+                                    spikeDur, ampAvgDur,
+                                    threshold, minAvgAmp, maxAHPAmp,
+                                    stream.positions.data(), neighborRadius, innerRadius,
+                                    temporalJitter, riseDur,
+                                    decayFiltering, decayRatio, localize,
+                                    saveShape, filename, cutoutStart, cutoutEnd, compressShape, neighborShape,
+                                    channelMask, sweepConfigs, tableFilename, artifactFraction);
+
+    // each block arrives when its last sample is acquired, paced in real time
+    vector<double> stepLatency(numBlocks);
+    vector<double> spikeLatency;
+    int numEmitted = 0;
+    steady_clock::time_point streamStart = steady_clock::now();
+    for (int i = 0; i < numBlocks; i++)
+    {
+        this_thread::sleep_until(streamStart + duration<double>((i + 1) * blockLen / samplingRate));
+
+        pDet->step(stream.trace.data() + (size_t)i * blockLen * numChannels, i * blockLen, blockLen);
+        double emitTime = duration<double>(steady_clock::now() - streamStart).count();
+        stepLatency[i] = pDet->getStepLatency();
+
+        int numResult = pDet->getNumResult();
+        const Spike *result = pDet->getResult();
+        for (; numEmitted < numResult; numEmitted++) // latency from arrival of the peak sample
+        {
+            double arrival = (result[numEmitted].frame / blockLen + 1) * blockLen / samplingRate;
+            spikeLatency.push_back(emitTime - arrival);
+        }
+    }
+    pDet->finish();
+
+    int procDelay = SpikeQueue::getProcDelay(spikeDur, riseDur, temporalJitter, cutoutEnd);
+    fprintf(stderr, "detected spikes: %6d, emitted online: %6d\n", pDet->getNumResult(), numEmitted);
+    fprintf(stderr, "algorithmic delay: %d frames (%.3fms)\n",
+            spikeDur + procDelay, (spikeDur + procDelay) * 1000 / samplingRate);
+    fprintf(stderr, "block processing (ms): p50 %.3f, p99 %.3f, max %.3f\n",
+            percentile(stepLatency, 50) * 1000, percentile(stepLatency, 99) * 1000,
+            percentile(stepLatency, 100) * 1000);
+    fprintf(stderr, "arrival to emission (ms): p50 %.3f, p99 %.3f, max %.3f\n",
+            percentile(spikeLatency, 50) * 1000, percentile(spikeLatency, 99) * 1000,
+            percentile(spikeLatency, 100) * 1000);
+
+    delete pDet;
+
+    return 0;
+}
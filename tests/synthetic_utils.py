@@ -0,0 +1,76 @@
+from pathlib import Path
+from typing import Any, Iterable, Mapping, Optional
+
+import numpy as np
+from hs_detection import HSDetection
+from hs_detection.recording import RealArray
+
+result_cache = Path(__file__).parent / 'data' / 'result_synthetic'
+
+
+class SyntheticRecording(object):
+    """Seeded noise and spikes on a two-column probe, in the `Recording` interface, so \
+    that tests of features run without spikeinterface or downloaded data. Each spike \
+    spreads to the channels within two rows, halving in amplitude per channel.
+    """
+
+    def __init__(self, num_channels: int = 64, num_frames: int = 320000, seed: int = 0) -> None:
+        rng = np.random.default_rng(seed)
+        self.traces = rng.normal(0, 20, (num_frames, num_channels)).astype(np.float32)
+
+        waveform = np.r_[np.linspace(0, 1, 5), np.linspace(1, 0, 5), -0.2 * np.ones(20)]
+        num_spikes = num_frames // 100
+        frames = rng.integers(100, num_frames - 100, num_spikes)
+        channels = rng.integers(0, num_channels, num_spikes)
+        amps = rng.uniform(-1000, -400, num_spikes)
+        for dc in range(-2, 3):
+            valid = (channels + dc >= 0) & (channels + dc < num_channels)
+            for t, w in enumerate(waveform):
+                np.add.at(self.traces, (frames[valid] + t, channels[valid] + dc),
+                          (amps[valid] / (1 + abs(dc)) * w).astype(np.float32))
+
+        self.positions = np.c_[(np.arange(num_channels) % 2) * 16,
+                               (np.arange(num_channels) // 2) * 20].astype(np.float64)
+
+    def add_artifacts(self, frames: Iterable[int], seed: int = 5) -> None:
+        """Swing of +-700 over 20 frames at each of `frames` on all channels, as from \
+        stimulation, with a gain per channel so that the common reference does not cancel it.
+        """
+        gain = np.random.default_rng(seed).uniform(-1, 3, self.traces.shape[1])
+        swing = np.r_[np.linspace(-700, 700, 10), np.linspace(700, -700, 10)]
+        for frame in frames:
+            self.traces[frame:frame + len(swing)] += (swing[:, None] * gain).astype(np.float32)
+
+    def get_num_channels(self) -> int:
+        return self.traces.shape[1]
+
+    def get_channel_ids(self) -> Iterable[Any]:
+        return range(self.traces.shape[1])
+
+    def get_channel_property(self, channel_id: Any, key: Any) -> Any:
+        assert key == 'location'
+        return self.positions[channel_id]
+
+    def get_sampling_frequency(self) -> float:
+        return 32000.0
+
+    def get_num_segments(self) -> int:
+        return 1
+
+    def get_num_samples(self, segment_index: Optional[int] = None) -> int:
+        return self.traces.shape[0]
+
+    def get_traces(self,
+                   segment_index: Optional[int] = None,
+                   start_frame: Optional[int] = None,
+                   end_frame: Optional[int] = None,
+                   **kwargs: Any
+                   ) -> RealArray:
+        return self.traces[start_frame:end_frame]
+
+
+def detect_synthetic(recording: SyntheticRecording, name: str, **params: Any) -> Mapping[str, RealArray]:
+    """Detect on the only segment, with the shapes saved under `name` in the result cache."""
+    result_cache.mkdir(parents=True, exist_ok=True)
+    params = HSDetection.DEFAULT_PARAMS | {'out_file': result_cache / name, 'verbose': False} | params
+    return HSDetection(recording, params).detect()[0]
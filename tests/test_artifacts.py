@@ -0,0 +1,55 @@
+import numpy as np
+from hs_detection import HSDetection
+
+from synthetic_utils import SyntheticRecording, detect_synthetic, result_cache
+
+
+def _keys(result) -> set:
+    return set(zip(result['sample_ind'].tolist(), result['channel_ind'].tolist()))
+
+
+def _in_intervals(frames: np.ndarray, intervals: np.ndarray) -> np.ndarray:
+    return ((frames[:, None] >= intervals[:, 0]) & (frames[:, None] < intervals[:, 1])).any(axis=1)
+
+
+def test_artifacts(max_fraction: float = 0.005) -> None:
+    steps = [50000, 123456, 250000]
+    clean = SyntheticRecording()
+    recording = SyntheticRecording()
+    recording.add_artifacts(steps)
+
+    blanked = detect_synthetic(recording, 'artifacts_blanked', artifact_fraction=0.25)
+    unblanked = detect_synthetic(recording, 'artifacts_unblanked')
+    reference = detect_synthetic(clean, 'artifacts_clean', artifact_fraction=0.25)
+    assert 'artifacts' not in unblanked and len(reference['artifacts']) == 0
+
+    # intervals only within the swings, some in each, and no spike left in the swings
+    artifacts = blanked['artifacts']
+    swings = np.array([[step, step + 20] for step in steps])
+    print(artifacts.tolist())
+    assert artifacts.dtype == np.int32 and np.all(artifacts[:, 0] < artifacts[:, 1])
+    assert _in_intervals(artifacts[:, 0], swings).all() and _in_intervals(artifacts[:, 1] - 1, swings).all()
+    assert _in_intervals(swings[:, 0], artifacts).all()
+    print(_in_intervals(unblanked['sample_ind'], swings).sum(), _in_intervals(blanked['sample_ind'], swings).sum())
+    assert _in_intervals(unblanked['sample_ind'], swings).any()
+    assert not _in_intervals(blanked['sample_ind'], swings).any()
+
+    # elsewhere as on the clean recording, but for a few near the threshold after the swings
+    print(len(reference['sample_ind']), len(blanked['sample_ind']))
+    assert _keys(blanked) <= _keys(reference)
+    assert len(_keys(reference) - _keys(blanked)) <= max_fraction * len(reference['sample_ind'])
+
+    # stream in blocks across the intervals, closed intervals returned once
+    det = HSDetection(recording, HSDetection.DEFAULT_PARAMS |
+                      {'out_file': result_cache / 'artifacts_stream', 'verbose': False,
+                       'artifact_fraction': 0.25, 'save_shape': False})
+    det.open_stream()
+    parts = [det.push(recording.get_traces(start_frame=start, end_frame=start + 777))
+             for start in range(0, recording.get_num_samples(), 777)] + [det.close_stream()]
+    assert np.array_equal(artifacts, np.concatenate([part['artifacts'] for part in parts]))
+    for k in ['sample_ind', 'channel_ind', 'amplitude', 'location']:
+        assert np.array_equal(blanked[k], np.concatenate([part[k] for part in parts])), k
+
+
+if __name__ == '__main__':
+    test_artifacts()
@@ -0,0 +1,78 @@
+from typing import Any, Optional
+
+import numpy as np
+from hs_detection import HSDetection
+
+from synthetic_utils import SyntheticRecording, detect_synthetic, result_cache
+
+
+class InterruptedRecording(SyntheticRecording):
+    """Raises on reading past `interrupt_at`, as a preempted job."""
+
+    interrupt_at: Optional[int] = None
+
+    def get_traces(self, segment_index: Optional[int] = None, start_frame: Optional[int] = None,
+                   end_frame: Optional[int] = None, **kwargs: Any):
+        if self.interrupt_at is not None and end_frame is not None and end_frame > self.interrupt_at:
+            raise RuntimeError('interrupted')
+        return super().get_traces(segment_index, start_frame, end_frame, **kwargs)
+
+
+def test_checkpoint() -> None:
+    recording = InterruptedRecording()
+
+    for options in [{}, {'compress_shape': True}, {'neighbor_shape': True}]:
+        params = options | {'chunk_size': 30000}
+        batch = detect_synthetic(recording, 'checkpoint_batch', **params)
+        batch = {k: np.asarray(v).copy() for k, v in batch.items()}  # shape file of the next run differs
+
+        checkpoint = result_cache / 'checkpoint.state'
+        params |= {'checkpoint_file': checkpoint, 'checkpoint_interval': 0.0}
+        det = HSDetection(recording, HSDetection.DEFAULT_PARAMS |
+                          {'out_file': result_cache / 'checkpoint_run', 'verbose': False} | params)
+        recording.interrupt_at = 200000  # after the random chunks for initial estimation are read
+        try:
+            det.detect()
+        except RuntimeError:
+            pass
+        else:
+            assert False, 'not interrupted'
+        assert checkpoint.with_stem('checkpoint-0').exists()
+
+        recording.interrupt_at = None
+        resumed = detect_synthetic(recording, 'checkpoint_run', **params)
+        assert not checkpoint.with_stem('checkpoint-0').exists()  # removed when done
+        print(options, len(resumed['sample_ind']))
+        for k in batch.keys():
+            assert np.array_equal(batch[k], np.asarray(resumed[k])), k
+
+
+def test_stream_checkpoint(resume_at: int = 100000, block_len: int = 1000) -> None:
+    recording = SyntheticRecording()
+    params = HSDetection.DEFAULT_PARAMS | {'out_file': result_cache / 'checkpoint_stream', 'verbose': False,
+                                           'chunk_size': 4096}
+    num_frames = recording.get_num_samples()
+    state = result_cache / 'checkpoint_stream.state'
+
+    det = HSDetection(recording, params)
+    det.open_stream()
+    for start in range(0, resume_at, block_len):
+        det.push(recording.get_traces(start_frame=start, end_frame=start + block_len))
+    det.save_stream(state)
+    parts = [det.push(recording.get_traces(start_frame=start, end_frame=start + block_len))
+             for start in range(resume_at, num_frames, block_len)] + [det.close_stream()]
+
+    det = HSDetection(recording, params)
+    det.open_stream(resume_file=state)
+    resumed = [det.push(recording.get_traces(start_frame=start, end_frame=start + block_len))
+               for start in range(resume_at, num_frames, block_len)] + [det.close_stream()]
+
+    print(sum(len(part['sample_ind']) for part in parts))
+    for k in ['sample_ind', 'channel_ind', 'amplitude', 'location']:
+        assert np.array_equal(np.concatenate([part[k] for part in parts]),
+                              np.concatenate([part[k] for part in resumed])), k
+
+
+if __name__ == '__main__':
+    test_checkpoint()
+    test_stream_checkpoint()
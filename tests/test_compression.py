@@ -0,0 +1,26 @@
+import numpy as np
+
+from synthetic_utils import SyntheticRecording, detect_synthetic, result_cache
+
+
+def test_compression(min_ratio: float = 1.3) -> None:
+    recording = SyntheticRecording()
+
+    for neighbor_shape in [False, True]:
+        name = 'neighbor' if neighbor_shape else 'peak'
+        raw = detect_synthetic(recording, f'raw_{name}', neighbor_shape=neighbor_shape)
+        compressed = detect_synthetic(recording, f'compressed_{name}', neighbor_shape=neighbor_shape,
+                                      compress_shape=True)
+
+        for k in raw.keys():
+            assert np.array_equal(raw[k], np.asarray(compressed[k])), k
+
+        ratio = (result_cache / f'raw_{name}-0.bin').stat().st_size / \
+            (result_cache / f'compressed_{name}-0.hsz').stat().st_size
+        print(name, raw['spike_shape'].shape, f'{ratio:.3f}')
+        if neighbor_shape:  # about 1.1 if deltas were taken across channels and padding
+            assert ratio >= min_ratio, ratio
+
+
+if __name__ == '__main__':
+    test_compression()
@@ -0,0 +1,47 @@
+from typing import Optional
+
+import numpy as np
+
+from synthetic_utils import SyntheticRecording, detect_synthetic
+
+
+class SubsetRecording(SyntheticRecording):
+    """Only the given channels of a recording, renumbered from 0."""
+
+    def __init__(self, recording: SyntheticRecording, channels: np.ndarray) -> None:
+        self.traces = np.ascontiguousarray(recording.traces[:, channels])
+        self.positions = recording.positions[channels]
+
+
+def test_masking(bad_channels: Optional[list[int]] = None) -> None:
+    recording = SyntheticRecording()
+    bad_channels = bad_channels or [0, 5, 6, 31, 63]
+    recording.traces[:, bad_channels[0]] = 0  # dead
+    recording.traces[:, bad_channels[1]] *= 20  # noisy
+    good_channels = np.setdiff1d(np.arange(recording.get_num_channels()), bad_channels)
+
+    # masked as detected on the good channels only, with the indices of the recording
+    subset = detect_synthetic(SubsetRecording(recording, good_channels), 'masking_subset')
+    masked = detect_synthetic(recording, 'masking_masked', bad_channels=bad_channels)
+    print(len(subset['sample_ind']), len(masked['sample_ind']))
+    assert np.array_equal(good_channels[subset['channel_ind']], masked['channel_ind'])
+    for k in subset.keys():
+        if k != 'channel_ind':
+            assert np.array_equal(subset[k], masked[k]), k
+
+    # neighbours in saved shapes also by the indices of the recording, -1 for padding
+    subset = detect_synthetic(SubsetRecording(recording, good_channels), 'masking_subset', neighbor_shape=True)
+    masked = detect_synthetic(recording, 'masking_masked', bad_channels=bad_channels, neighbor_shape=True)
+    channels = subset['spike_channels']
+    assert np.array_equal(np.where(channels >= 0, good_channels[channels], -1), masked['spike_channels'])
+    assert np.array_equal(subset['spike_shape'], masked['spike_shape'])
+
+    # dead and noisy channels found by their spread
+    found = detect_synthetic(recording, 'masking_found', detect_bad_channels=True)
+    explicit = detect_synthetic(recording, 'masking_explicit', bad_channels=bad_channels[:2])
+    for k in explicit.keys():
+        assert np.array_equal(explicit[k], found[k]), k
+
+
+if __name__ == '__main__':
+    test_masking()
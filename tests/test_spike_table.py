@@ -0,0 +1,34 @@
+import numpy as np
+from hs_detection import SpikeTable
+
+from synthetic_utils import SyntheticRecording, detect_synthetic, result_cache
+
+
+def test_spike_table() -> None:
+    recording = SyntheticRecording()
+    sweep = [{'threshold': 8.0}]
+
+    for localize in [True, False]:
+        batch = detect_synthetic(recording, 'table_batch', localize=localize, sweep=sweep)
+        detect_synthetic(recording, 'table_run', localize=localize, sweep=sweep,
+                         table_file=result_cache / 'table')
+
+        for config, config_result in enumerate([batch] + batch['sweep']):
+            table = SpikeTable(result_cache / ('table-0.hst' if config == 0 else f'table-0.sweep{config}.hst'))
+            columns = table.columns()
+            print(localize, config, len(table), len(config_result['sample_ind']))
+            assert len(table) == len(config_result['sample_ind'])
+            assert columns.keys() == {'sample_ind', 'channel_ind', 'amplitude'} | ({'location'} if localize else set())
+            for k in columns.keys():
+                assert np.array_equal(config_result[k], columns[k]), (config, k)
+
+            # ranges by the index of blocks, as filtered from the whole
+            for frame_start, frame_end in [(0, 1), (1000, 123456), (300000, 400000), (5, 5)]:
+                keep = (frame_start <= config_result['sample_ind']) & (config_result['sample_ind'] < frame_end)
+                columns = table.read(frame_start, frame_end)
+                for k in columns.keys():
+                    assert np.array_equal(config_result[k][keep], columns[k]), (config, frame_start, k)
+
+
+if __name__ == '__main__':
+    test_spike_table()
@@ -0,0 +1,33 @@
+import numpy as np
+from hs_detection import HSDetection
+
+from synthetic_utils import SyntheticRecording, detect_synthetic, result_cache
+
+
+def test_stream(seed: int = 1) -> None:
+    recording = SyntheticRecording()
+    params = {'save_shape': False}
+    batch = detect_synthetic(recording, 'stream_batch', **params)
+
+    det = HSDetection(recording, HSDetection.DEFAULT_PARAMS |
+                      {'out_file': result_cache / 'stream', 'verbose': False} | params)
+    det.open_stream()
+
+    # tiny blocks for the first part, then blocks longer than a chunk
+    rng = np.random.default_rng(seed)
+    parts = []
+    start = 0
+    num_frames = recording.get_num_samples()
+    while start < num_frames:
+        block_len = int(rng.integers(1, 300)) if start < 100000 else 150000
+        parts.append(det.push(recording.get_traces(start_frame=start, end_frame=start + block_len)))
+        start += block_len
+    parts.append(det.close_stream())
+
+    print(len(parts), len(batch['sample_ind']))
+    for k in batch.keys():
+        assert np.array_equal(batch[k], np.concatenate([part[k] for part in parts])), k
+
+
+if __name__ == '__main__':
+    test_stream()
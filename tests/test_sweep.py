@@ -0,0 +1,22 @@
+import numpy as np
+
+from synthetic_utils import SyntheticRecording, detect_synthetic
+
+
+def test_sweep() -> None:
+    recording = SyntheticRecording()
+    sweep = [{'threshold': 8.0}, {'threshold': 12.0, 'min_avg_amp': 4.0},
+             {'AHP_thr': -1.0}, {'peak_jitter': 0.1}]
+
+    # each config in one pass as in a run of its own
+    result = detect_synthetic(recording, 'sweep', sweep=sweep)
+    assert len(result['sweep']) == len(sweep)
+    for config, config_result in zip([{}] + sweep, [result] + result['sweep']):
+        single = detect_synthetic(recording, 'sweep_single', **config)
+        print(config, len(single['sample_ind']), len(config_result['sample_ind']))
+        for k in single.keys():
+            assert np.array_equal(single[k], config_result[k]), (config, k)
+
+
+if __name__ == '__main__':
+    test_sweep()
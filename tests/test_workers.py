@@ -0,0 +1,38 @@
+import numpy as np
+from hs_detection import HSDetection, detect_parallel
+
+from synthetic_utils import SyntheticRecording, result_cache
+
+
+def _unmatched(spikes, other) -> int:
+    keys = set(zip(spikes['sample_ind'].tolist(), spikes['channel_ind'].tolist()))
+    other_keys = set(zip(other['sample_ind'].tolist(), other['channel_ind'].tolist()))
+    return len(keys - other_keys)
+
+
+def test_workers(seed: int = 2, max_fraction: float = 0.005) -> None:
+    # 4s in 1s shards, with an artifact across the edge of the first two
+    recording = SyntheticRecording(num_frames=128000, seed=seed)
+    recording.add_artifacts([20000, 31990, 70000])
+    params = HSDetection.DEFAULT_PARAMS | {'out_file': result_cache / 'workers', 'verbose': False,
+                                           'fast_init': True, 'artifact_fraction': 0.25,
+                                           'sweep': [{'threshold': 8.0}, {'threshold': 12.0}]}
+
+    single = HSDetection(recording, params).detect()[0]
+    sharded = detect_parallel(recording, params, num_workers=2, shard_duration=1.0, overlap_duration=1.0)[0]
+
+    # estimation restarts at each overlap, so a few spikes near the threshold may differ
+    for config, (a, b) in enumerate(zip([single] + single['sweep'], [sharded] + sharded['sweep'])):
+        bound = max_fraction * len(a['sample_ind'])
+        print(config, len(a['sample_ind']), len(b['sample_ind']), _unmatched(a, b), _unmatched(b, a))
+        assert abs(len(a['sample_ind']) - len(b['sample_ind'])) <= bound, config
+        assert _unmatched(a, b) <= bound and _unmatched(b, a) <= bound, config
+
+    # split at the edge and merged back
+    assert np.array_equal(single['artifacts'], sharded['artifacts']), sharded['artifacts']
+    assert np.any((single['artifacts'][:, 0] < 32000) & (single['artifacts'][:, 1] > 32000))
+
+
+if __name__ == '__main__':
+    test_workers(seed=2)
+    test_workers(seed=3)